@@ -0,0 +1,486 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+
+#include <seqan3/argument_parser/all.hpp>
+
+#include <bio/var_io/reader.hpp>
+
+#include "checksum.hpp"
+#include "decode.hpp"
+#include "encode.hpp"
+#include "encode_split.hpp"
+#include "shared.hpp"
+
+struct bench_options_t
+{
+    std::filesystem::path baseline;
+    std::filesystem::path write_baseline;
+    std::filesystem::path work_dir        = std::filesystem::temp_directory_path() / "bcfdelta-bench";
+    double                tolerance       = 0.25;
+    double                ratio_tolerance = 0.01;
+    size_t                n_records       = 10'000;
+    size_t                n_samples       = 100;
+    size_t                repeat          = 3;
+    size_t                threads =
+      std::max<size_t>(2, std::min<size_t>(8, std::thread::hardware_concurrency()));
+};
+
+bench_options_t parse_bench_arguments(seqan3::argument_parser & parser)
+{
+    parser.info.short_description = "Check round-trips and measure the performance on generated cohorts.";
+    parser.info.version           = version;
+    parser.info.date              = date;
+    parser.info.synopsis.push_back("bcfdelta bench [--baseline file.json] [--write-baseline file.json]");
+
+    bench_options_t options{};
+
+    parser.add_option(options.baseline,
+                      '\0',
+                      "baseline",
+                      "Fail if a compression ratio or a throughput relative to the plain conversion to BCF is worse "
+                      "than the one in this JSON file (beyond the tolerance).");
+
+    parser.add_option(options.write_baseline, '\0', "write-baseline", "Write the results to this JSON file.");
+
+    parser.add_option(options.tolerance,
+                      '\0',
+                      "tolerance",
+                      "Relative regression of the throughput that is tolerated when comparing with the baseline.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{0.0, 1.0});
+
+    parser.add_option(options.ratio_tolerance,
+                      '\0',
+                      "ratio-tolerance",
+                      "Relative regression of the compression ratios that is tolerated when comparing with the "
+                      "baseline (the cohort is generated with a fixed seed, so the ratios are deterministic).",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{0.0, 1.0});
+
+    parser.add_subsection("Cohort:");
+
+    parser.add_option(options.n_records,
+                      '\0',
+                      "records",
+                      "Number of records to generate.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{100, 10'000'000});
+
+    parser.add_option(options.n_samples,
+                      '\0',
+                      "samples",
+                      "Number of samples to generate.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{1, 1'000'000});
+
+    parser.add_option(options.work_dir, '\0', "work-dir", "Directory for the generated and encoded files.");
+
+    parser.add_subsection("Performance:");
+
+    parser.add_option(options.repeat,
+                      '\0',
+                      "repeat",
+                      "Run every measurement this many times and keep the fastest.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{1, 100});
+
+    parser.add_option(options.threads,
+                      '@',
+                      "threads",
+                      "Maximum number of threads to use.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{2u, std::thread::hardware_concurrency() * 2});
+
+    parser.parse();
+
+    return options;
+}
+
+/* Write a VCF file with a fixed seed, so that the cohort is the same for every run and on every platform
+ * (the distributions of the standard library are implementation-defined, so only the raw generator is used).
+ * There are integer FORMAT fields of every Number class, a Float field and String fields; values are correlated
+ * between records like in real data. One in ten records is multi-allelic.
+ */
+void generate_cohort(std::filesystem::path const & path, size_t const n_records, size_t const n_samples)
+{
+    std::ofstream out{path};
+    if (!out)
+        throw delta_error{"Could not open ", path, " for writing."};
+
+    out << "##fileformat=VCFv4.3\n"
+           "##contig=<ID=1,length=250000000>\n"
+           "##contig=<ID=2,length=250000000>\n"
+           "##FILTER=<ID=PASS,Description=\"All filters passed\">\n"
+           "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Total depth\">\n"
+           "##INFO=<ID=AC,Number=A,Type=Integer,Description=\"Allele count\">\n"
+           "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n"
+           "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Read depth\">\n"
+           "##FORMAT=<ID=AD,Number=R,Type=Integer,Description=\"Allelic depths\">\n"
+           "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Genotype likelihoods\">\n"
+           "##FORMAT=<ID=SB,Number=4,Type=Integer,Description=\"Strand bias\">\n"
+           "##FORMAT=<ID=PQ,Number=.,Type=Integer,Description=\"Values of varying number\">\n"
+           "##FORMAT=<ID=AF,Number=A,Type=Float,Description=\"Allele fractions\">\n"
+           "##FORMAT=<ID=FT,Number=1,Type=String,Description=\"Sample filter\">\n"
+           "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+    for (size_t s = 0; s < n_samples; ++s)
+        out << "\tS" << s;
+    out << '\n';
+
+    std::mt19937_64      rng{42};
+    std::vector<int32_t> depth(n_samples, 30);
+    std::vector<int32_t> alleles(n_samples);
+    std::string          line;
+    int64_t              pos = 0;
+
+    for (size_t k = 0; k < n_records; ++k)
+    {
+        bool const   second_half = k >= n_records / 2;
+        size_t const n_alts      = rng() % 10 == 0 ? 2 : 1;
+        size_t const n_gts       = (n_alts + 1) * (n_alts + 2) / 2;
+
+        pos = (second_half && k == n_records / 2) ? 1 : pos + 1 + rng() % 300;
+
+        // genotypes first, so that INFO can summarise them
+        int32_t total_depth = 0;
+        int32_t ac[2]       = {0, 0};
+        for (size_t s = 0; s < n_samples; ++s)
+        {
+            depth[s] = std::max<int32_t>(1, depth[s] + static_cast<int32_t>(rng() % 5) - 2);
+            total_depth += depth[s];
+
+            uint64_t const r = rng() % 100;
+            alleles[s]       = r < 80 ? 0 : r < 95 ? 1 : 2; // number of alternative alleles
+            uint64_t const alt = n_alts == 2 && rng() % 4 == 0 ? 2 : 1;
+            ac[alt - 1] += alleles[s];
+            alleles[s] = alleles[s] * 10 + alt;
+        }
+
+        line.clear();
+        line += second_half ? "2\t" : "1\t";
+        line += std::to_string(pos);
+        line += n_alts == 2 ? "\t.\tA\tC,G\t50\tPASS\tDP=" : "\t.\tA\tC\t50\tPASS\tDP=";
+        line += std::to_string(total_depth);
+        line += ";AC=" + std::to_string(ac[0]);
+        if (n_alts == 2)
+            line += "," + std::to_string(ac[1]);
+        line += "\tGT:DP:AD:PL:SB:PQ:AF:FT";
+
+        for (size_t s = 0; s < n_samples; ++s)
+        {
+            if (rng() % 200 == 0) // missing sample
+            {
+                line += "\t./.:.:.:.:.:.:.:.";
+                continue;
+            }
+
+            int32_t const n_alt  = alleles[s] / 10;
+            int32_t const alt    = alleles[s] % 10;
+            int32_t const alt_dp = n_alt == 0 ? static_cast<int32_t>(rng() % 2) : depth[s] * n_alt / 2;
+            char const    sep    = rng() % 20 == 0 ? '|' : '/';
+
+            line += '\t';
+            line += n_alt == 0 ? '0' : static_cast<char>('0' + alt);
+            line += sep;
+            line += n_alt < 2 ? '0' : static_cast<char>('0' + alt);
+            if (n_alt == 1)
+                std::swap(line[line.size() - 1], line[line.size() - 3]);
+
+            line += ':' + std::to_string(depth[s]);
+
+            line += ':' + std::to_string(depth[s] - alt_dp);
+            for (size_t a = 1; a <= n_alts; ++a)
+                line += ',' + std::to_string(static_cast<int32_t>(a) == alt ? alt_dp : 0);
+
+            line += ':';
+            for (size_t g = 0; g < n_gts; ++g)
+            {
+                int32_t const pl =
+                  g == static_cast<size_t>(n_alt) ? 0 : 10 * depth[s] / 3 + 3 * static_cast<int32_t>(g);
+                line += (g == 0 ? "" : ",") + std::to_string(pl);
+            }
+
+            line += ':' + std::to_string(depth[s] / 2) + ',' + std::to_string(depth[s] - depth[s] / 2) + ',' +
+                    std::to_string(alt_dp / 2) + ',' + std::to_string(alt_dp - alt_dp / 2);
+
+            line += ':' + std::to_string(depth[s] % 7) + ',' + std::to_string(depth[s] % 11);
+
+            line += ':';
+            for (size_t a = 1; a <= n_alts; ++a)
+            {
+                int32_t const thousandths = static_cast<int32_t>(a) == alt ? 1000 * alt_dp / depth[s] : 0;
+                line += (a == 1 ? "" : ",") + std::to_string(thousandths / 1000) + '.' +
+                        std::to_string(1000 + thousandths % 1000).substr(1);
+            }
+
+            line += rng() % 50 == 0 ? ":LowQual" : ":PASS";
+        }
+
+        line += '\n';
+        out << line;
+    }
+
+    if (!out)
+        throw delta_error{"Could not write ", path, "."};
+}
+
+/* Check that the decoded file contains the original records. The original is the cohort converted to BCF without
+ * delta-compression, so that only the delta round-trip is checked and not the conversion from VCF. Decoding does not
+ * undo the splitting of fields, so the original records are split in the same way before comparing.
+ */
+void check_roundtrip(std::filesystem::path const & original_path,
+                     std::filesystem::path const & decoded_path,
+                     bool const                    split_fields)
+{
+    auto reader_options = bio::var_io::reader_options{.field_types = bio::var_io::field_types<bio::ownership::deep>};
+
+    bio::var_io::reader original_reader{original_path, reader_options};
+    bio::var_io::reader decoded_reader{decoded_path, reader_options};
+
+    split_buffers_t split_buffers;
+    std::string     original_buffer;
+    std::string     decoded_buffer;
+
+    auto   dit = decoded_reader.begin();
+    size_t n   = 0;
+    for (bio::var_io::default_record<> & record : original_reader)
+    {
+        if (dit == decoded_reader.end())
+            throw delta_error{"Round-trip failed: the decoded file ", decoded_path, " has only ", n, " records."};
+
+        if (split_fields)
+            do_split(record, split_buffers);
+
+        original_buffer.clear();
+        decoded_buffer.clear();
+        record_normaliser{original_buffer}(record);
+        record_normaliser{decoded_buffer}(*dit);
+
+        if (original_buffer != decoded_buffer)
+        {
+            throw delta_error{"Round-trip failed: record ",
+                              n,
+                              " (",
+                              record.chrom(),
+                              ":",
+                              record.pos(),
+                              ") of ",
+                              decoded_path,
+                              " differs from the original."};
+        }
+
+        ++dit;
+        ++n;
+    }
+
+    if (dit != decoded_reader.end())
+        throw delta_error{"Round-trip failed: the decoded file ", decoded_path, " has more records than the original."};
+}
+
+// results are stored as "scenario/metric": value; for all metrics, higher is better
+using bench_results_t = std::map<std::string, double>;
+
+void write_bench_results(std::filesystem::path const & path, bench_results_t const & results)
+{
+    std::ofstream out{path};
+    if (!out)
+        throw delta_error{"Could not open ", path, " for writing."};
+
+    out << "{\n";
+    for (auto it = results.begin(); it != results.end(); ++it)
+        out << "  \"" << it->first << "\": " << it->second << (std::next(it) == results.end() ? "\n" : ",\n");
+    out << "}\n";
+}
+
+// reads the flat JSON objects written by write_bench_results()
+bench_results_t read_bench_results(std::filesystem::path const & path)
+{
+    std::ifstream in{path};
+    if (!in)
+        throw delta_error{"Could not open the baseline ", path, "."};
+
+    std::string const text{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+
+    bench_results_t ret;
+    for (size_t pos = text.find('"'); pos != std::string::npos; pos = text.find('"', pos))
+    {
+        size_t const key_end = text.find('"', pos + 1);
+        size_t const colon   = text.find(':', key_end);
+        if (key_end == std::string::npos || colon == std::string::npos)
+            throw delta_error{"Malformed baseline ", path, "."};
+
+        size_t const value_begin = text.find_first_not_of(" \t\n", colon + 1);
+        if (value_begin == std::string::npos)
+            throw delta_error{"Malformed baseline ", path, "."};
+
+        double value         = 0;
+        auto const [end, ec] = std::from_chars(text.data() + value_begin, text.data() + text.size(), value);
+        if (ec != std::errc{})
+            throw delta_error{"Malformed value in baseline ", path, "."};
+
+        ret[text.substr(pos + 1, key_end - pos - 1)] = value;
+        pos                                          = end - text.data();
+    }
+
+    return ret;
+}
+
+/* Generates a cohort and runs every scenario: encode, decode, check the round-trip. The throughput of encoding and
+ * decoding (records per second, fastest of --repeat runs) and the compression ratio (size of the BCF file without
+ * delta-compression divided by the size of the encoded file) are reported. The results that are written to and
+ * compared with a baseline are the ratios and the throughputs relative to the plain conversion to BCF (VCF to BCF for
+ * encoding, BCF to BCF for decoding), so that a baseline does not depend on the speed of the machine.
+ */
+void bench(bench_options_t const & options)
+{
+    std::filesystem::create_directories(options.work_dir);
+
+    std::filesystem::path const cohort = options.work_dir / "cohort.vcf";
+    generate_cohort(cohort, options.n_records, options.n_samples);
+
+    struct scenario_t
+    {
+        std::string name;
+        bool        split_fields    = false;
+        bool        compress_floats = false;
+        bool        compress_info   = false;
+        bool        compress_gt     = false;
+    };
+
+    std::vector<scenario_t> const scenarios{
+      {.name = "default"},
+      {.name = "split", .split_fields = true},
+      {.name = "floats", .compress_floats = true},
+      {.name = "info", .compress_info = true},
+      {.name = "gt", .compress_gt = true},
+    };
+
+    auto encode_options = [&](std::filesystem::path const & output)
+    {
+        encode_options_t ret{};
+        ret.input       = cohort;
+        ret.output      = output;
+        ret.output_type = "b";
+        ret.threads     = options.threads;
+        return ret;
+    };
+
+    // the fastest of --repeat runs in seconds
+    auto measure = [&](auto && fun)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < options.repeat; ++i)
+        {
+            auto const start = std::chrono::steady_clock::now();
+            fun();
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    };
+
+    // the plain conversions: VCF to BCF, and BCF to BCF as the counterpart of decoding
+    std::filesystem::path const plain         = options.work_dir / "plain.bcf";
+    encode_options_t            plain_options = encode_options(plain);
+    plain_options.delta_compress              = false;
+
+    double const plain_encode_rate = options.n_records / measure([&] { encode(plain_options); });
+    double const plain_size        = std::filesystem::file_size(plain);
+
+    std::filesystem::path const plain_copy   = options.work_dir / "plain.copy.bcf";
+    encode_options_t            copy_options = encode_options(plain_copy);
+    copy_options.input                       = plain;
+    copy_options.delta_compress              = false;
+
+    double const plain_decode_rate = options.n_records / measure([&] { encode(copy_options); });
+    std::filesystem::remove(plain_copy);
+
+    bench_results_t results;
+    std::cout << std::left << std::setw(10) << "scenario" << std::right << std::setw(18) << "encode (rec/s)"
+              << std::setw(18) << "decode (rec/s)" << std::setw(10) << "ratio" << '\n';
+    std::cout << std::left << std::setw(10) << "plain" << std::right << std::fixed << std::setprecision(0)
+              << std::setw(18) << plain_encode_rate << std::setw(18) << plain_decode_rate << std::setprecision(3)
+              << std::setw(10) << 1.0 << '\n';
+
+    for (scenario_t const & scenario : scenarios)
+    {
+        std::filesystem::path const encoded = options.work_dir / (scenario.name + ".bcf");
+        std::filesystem::path const decoded = options.work_dir / (scenario.name + ".decoded.bcf");
+
+        encode_options_t enc_options = encode_options(encoded);
+        enc_options.split_fields     = scenario.split_fields;
+        enc_options.compress_floats  = scenario.compress_floats;
+        enc_options.compress_info    = scenario.compress_info;
+        enc_options.compress_gt      = scenario.compress_gt;
+        double const encode_time     = measure([&] { encode(enc_options); });
+
+        decode_options_t dec_options{};
+        dec_options.input       = encoded;
+        dec_options.output      = decoded;
+        dec_options.output_type = "b";
+        dec_options.threads     = options.threads;
+        double const decode_time = measure([&] { decode(dec_options); });
+
+        check_roundtrip(plain, decoded, scenario.split_fields);
+
+        double const encode_rate = options.n_records / encode_time;
+        double const decode_rate = options.n_records / decode_time;
+        double const ratio       = plain_size / std::filesystem::file_size(encoded);
+
+        results[scenario.name + "/encode_vs_plain"] = encode_rate / plain_encode_rate;
+        results[scenario.name + "/decode_vs_plain"] = decode_rate / plain_decode_rate;
+        results[scenario.name + "/ratio"]           = ratio;
+
+        std::cout << std::left << std::setw(10) << scenario.name << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(18) << encode_rate << std::setw(18) << decode_rate << std::setprecision(3)
+                  << std::setw(10) << ratio << '\n';
+
+        std::filesystem::remove(encoded);
+        std::filesystem::remove(decoded);
+    }
+
+    std::filesystem::remove(plain);
+    std::filesystem::remove(cohort);
+
+    std::cout << "All round-trips succeeded.\n";
+
+    if (!options.write_baseline.empty())
+        write_bench_results(options.write_baseline, results);
+
+    if (!options.baseline.empty())
+    {
+        bench_results_t const baseline = read_bench_results(options.baseline);
+        if (baseline.empty())
+            throw delta_error{"The baseline ", options.baseline, " has no values; create it with --write-baseline."};
+
+        size_t n_regressions = 0;
+        for (auto const & [key, expected] : baseline)
+        {
+            double const tolerance = key.ends_with("/ratio") ? options.ratio_tolerance : options.tolerance;
+
+            auto it = results.find(key);
+            if (it == results.end())
+            {
+                std::cerr << "Baseline value " << key << " was not measured.\n";
+            }
+            else if (it->second < expected * (1.0 - tolerance))
+            {
+                std::cerr << "Regression in " << key << ": " << it->second << " (baseline: " << expected << ").\n";
+                ++n_regressions;
+            }
+        }
+
+        if (n_regressions > 0)
+        {
+            std::cerr << n_regressions << " regression(s) beyond the tolerance (" << options.tolerance
+                      << " for throughputs, " << options.ratio_tolerance << " for ratios). Exiting.\n";
+            std::exit(1);
+        }
+
+        std::cout << "No regressions compared with the baseline.\n";
+    }
+}
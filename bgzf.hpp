@@ -0,0 +1,663 @@
+#pragma once
+
+/* A BGZF-compressing output stream that keeps the compressed offset of every block, so that offsets into the
+ * uncompressed data can be turned into BGZF virtual offsets (needed for indexes). All blocks except the last hold
+ * exactly block_size bytes of uncompressed data. Blocks are deflated on the given number of threads while the next
+ * blocks are being written to the stream. The threads live as long as the stream, so that their (thread-local)
+ * compressors are reused.
+ * And a BGZF-decompressing input stream that inflates the blocks on threads while the previous ones are being read.
+ */
+
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#ifdef BCFDELTA_HAVE_LIBDEFLATE
+#    include <libdeflate.h>
+#endif
+
+#include "shared.hpp"
+#include "uring.hpp"
+
+// the uncompressed data of a block; small enough that the compressed block always fits into 64 KiB
+inline constexpr size_t bgzf_block_size = 0xff00;
+
+// whether BGZF files are deflated and inflated by the streams below instead of the library's
+#ifdef BCFDELTA_HAVE_LIBDEFLATE
+inline constexpr bool bgzf_libdeflate = true;
+#else
+inline constexpr bool bgzf_libdeflate = false;
+#endif
+
+#ifdef BCFDELTA_HAVE_LIBDEFLATE
+// one compressor per thread and level, because allocating one is expensive
+libdeflate_compressor * thread_libdeflate_compressor(int const level)
+{
+    struct deleter
+    {
+        void operator()(libdeflate_compressor * compressor) const { libdeflate_free_compressor(compressor); }
+    };
+
+    thread_local std::array<std::unique_ptr<libdeflate_compressor, deleter>, 13> compressors;
+
+    std::unique_ptr<libdeflate_compressor, deleter> & compressor = compressors[level];
+    if (!compressor)
+    {
+        compressor.reset(libdeflate_alloc_compressor(level));
+        if (!compressor)
+            throw delta_error{"Could not initialise libdeflate."};
+    }
+
+    return compressor.get();
+}
+
+// one decompressor per thread
+libdeflate_decompressor * thread_libdeflate_decompressor()
+{
+    struct deleter
+    {
+        void operator()(libdeflate_decompressor * decompressor) const { libdeflate_free_decompressor(decompressor); }
+    };
+
+    thread_local std::unique_ptr<libdeflate_decompressor, deleter> decompressor{libdeflate_alloc_decompressor()};
+    if (!decompressor)
+        throw delta_error{"Could not initialise libdeflate."};
+
+    return decompressor.get();
+}
+#endif
+
+/* raw-deflate the data into out; returns the compressed size, or 0 if it does not fit.
+ * Uses libdeflate if available (it is faster than zlib and compresses a bit better), except for level 0.
+ */
+size_t bgzf_deflate(std::span<char const> const data, int const level, std::span<char> const out)
+{
+#ifdef BCFDELTA_HAVE_LIBDEFLATE
+    if (level != 0)
+    {
+        return libdeflate_deflate_compress(thread_libdeflate_compressor(level < 0 ? 6 : level),
+                                           data.data(),
+                                           data.size(),
+                                           out.data(),
+                                           out.size());
+    }
+#endif
+
+    z_stream zs{};
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw delta_error{"Could not initialise deflate."};
+
+    zs.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in  = data.size();
+    zs.next_out  = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+
+    int const ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+
+    return ret == Z_STREAM_END ? zs.total_out : 0;
+}
+
+// deflate the data into a complete BGZF block (header, raw deflate data, CRC32 and size)
+void bgzf_compress_block(std::span<char const> const data, int const level, std::vector<char> & out)
+{
+    constexpr size_t header_size = 18;
+    constexpr size_t footer_size = 8;
+    constexpr size_t max_size    = 65536;
+
+    out.resize(max_size);
+
+    size_t const deflated_size =
+      bgzf_deflate(data, level, std::span<char>{out.data() + header_size, max_size - header_size - footer_size});
+
+    if (deflated_size == 0)
+    {
+        if (level == 0)
+            throw delta_error{"Could not deflate BGZF block."};
+
+        // incompressible data; stored blocks always fit
+        bgzf_compress_block(data, 0, out);
+        return;
+    }
+
+    size_t const size = header_size + deflated_size + footer_size;
+
+    auto put_le = [&](size_t const pos, uint32_t const value, size_t const n_bytes)
+    {
+        for (size_t i = 0; i < n_bytes; ++i)
+            out[pos + i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    };
+
+    constexpr unsigned char header[header_size - 2] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0};
+    std::copy(std::begin(header), std::end(header), out.begin());
+    put_le(header_size - 2, size - 1, 2);
+
+    uint32_t const crc = crc32(crc32(0, nullptr, 0), reinterpret_cast<Bytef const *>(data.data()), data.size());
+    put_le(size - footer_size, crc, 4);
+    put_le(size - 4, data.size(), 4);
+
+    out.resize(size);
+}
+
+class bgzf_ostream : public std::ostream
+{
+public:
+    // called with all uncompressed data in order (before it is compressed)
+    using observer_t = std::function<void(std::span<char const>)>;
+
+    bgzf_ostream(std::unique_ptr<std::ostream> out, size_t const threads, int const level) :
+      std::ostream{nullptr}, buf{std::move(out), std::max<size_t>(threads, 1), level}
+    {
+        rdbuf(&buf);
+        exceptions(std::ios_base::badbit);
+    }
+
+    ~bgzf_ostream()
+    {
+        try
+        {
+            finish();
+        }
+        catch (...)
+        {}
+    }
+
+    void set_observer(observer_t observer) { buf.observer = std::move(observer); }
+
+    // compress and write all remaining data and the EOF marker and close the underlying stream; nothing can be written
+    // afterwards
+    void finish() { buf.finish(); }
+
+    // the virtual offset (block offset << 16 | offset in block) of an offset in the uncompressed data; after finish()
+    uint64_t virtual_offset(uint64_t const offset) const
+    {
+        return buf.block_offsets[offset / bgzf_block_size] << 16 | offset % bgzf_block_size;
+    }
+
+private:
+    struct bgzf_streambuf : public std::streambuf
+    {
+        std::unique_ptr<std::ostream> out;
+        size_t const                  threads;
+        int const                     level;
+        observer_t                    observer;
+
+        std::vector<char>              data;         // the put area
+        std::vector<char>              pending_data; // being compressed and written
+        std::vector<std::vector<char>> compressed;   // the blocks of pending_data
+
+        std::vector<uint64_t> block_offsets; // compressed offset of every block and of the end
+        uint64_t              offset   = 0;  // compressed offset of the next block
+        bool                  finished = false;
+
+        /* Every worker deflates every threads-th block of pending_data; the last one to finish writes the blocks in
+         * order. The members below are guarded by mutex.
+         */
+        std::vector<std::thread> workers;
+        std::mutex               mutex;
+        std::condition_variable  cv_work;
+        std::condition_variable  cv_done;
+        uint64_t                 generation   = 0; // incremented for every hand-off
+        size_t                   pending_size = 0; // of pending_data
+        size_t                   running      = 0; // workers that have not finished the current hand-off
+        bool                     busy         = false;
+        bool                     stop         = false;
+        std::exception_ptr       error;
+
+        bgzf_streambuf(std::unique_ptr<std::ostream> out, size_t const threads, int const level) :
+          out{std::move(out)}, threads{threads}, level{level}, data(4 * threads * bgzf_block_size)
+        {
+            setp(data.data(), data.data() + data.size());
+
+            for (size_t t = 0; t < threads; ++t)
+                workers.emplace_back([this, t] { work(t); });
+        }
+
+        ~bgzf_streambuf()
+        {
+            {
+                std::unique_lock lock{mutex};
+                cv_done.wait(lock, [this] { return !busy; });
+                stop = true;
+            }
+            cv_work.notify_all();
+
+            for (std::thread & worker : workers)
+                worker.join();
+        }
+
+        // wait until the pending data is written; rethrows errors of the compression or writing
+        void wait()
+        {
+            std::unique_lock lock{mutex};
+            cv_done.wait(lock, [this] { return !busy; });
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        void work(size_t const first)
+        {
+            uint64_t seen = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock lock{mutex};
+                    cv_work.wait(lock, [&] { return stop || generation != seen; });
+                    if (stop)
+                        return;
+                    seen = generation;
+                }
+
+                std::exception_ptr e;
+                try
+                {
+                    size_t const n_blocks = (pending_size + bgzf_block_size - 1) / bgzf_block_size;
+                    for (size_t b = first; b < n_blocks; b += threads)
+                    {
+                        size_t const begin = b * bgzf_block_size;
+                        bgzf_compress_block(std::span<char const>{pending_data.data() + begin,
+                                                                  std::min(bgzf_block_size, pending_size - begin)},
+                                            level,
+                                            compressed[b]);
+                    }
+                }
+                catch (...)
+                {
+                    e = std::current_exception();
+                }
+
+                bool last = false;
+                {
+                    std::lock_guard lock{mutex};
+                    if (e && !error)
+                        error = e;
+                    last = --running == 0;
+                    if (last && error)
+                        e = error;
+                }
+
+                if (!last)
+                    continue;
+
+                if (!e)
+                {
+                    try
+                    {
+                        write_blocks();
+                    }
+                    catch (...)
+                    {
+                        e = std::current_exception();
+                    }
+                }
+
+                {
+                    std::lock_guard lock{mutex};
+                    if (e && !error)
+                        error = e;
+                    busy = false;
+                }
+                cv_done.notify_all();
+            }
+        }
+
+        // write the deflated blocks of pending_data in order
+        void write_blocks()
+        {
+            size_t const n_blocks = (pending_size + bgzf_block_size - 1) / bgzf_block_size;
+            for (size_t b = 0; b < n_blocks; ++b)
+            {
+                block_offsets.push_back(offset);
+                out->write(compressed[b].data(), compressed[b].size());
+                offset += compressed[b].size();
+            }
+
+            if (!*out)
+                throw delta_error{"Could not write the BGZF output."};
+        }
+
+        // hand the put area to the workers and continue in the other buffer
+        void hand_off()
+        {
+            size_t const size = pptr() - pbase();
+            if (size == 0)
+                return;
+
+            if (observer)
+                observer(std::span<char const>{pbase(), size});
+
+            wait();
+            std::swap(data, pending_data);
+            data.resize(pending_data.size());
+            setp(data.data(), data.data() + data.size());
+
+            size_t const n_blocks = (size + bgzf_block_size - 1) / bgzf_block_size;
+            if (compressed.size() < n_blocks)
+                compressed.resize(n_blocks);
+
+            {
+                std::lock_guard lock{mutex};
+                pending_size = size;
+                running      = workers.size();
+                busy         = true;
+                ++generation;
+            }
+            cv_work.notify_all();
+        }
+
+        int_type overflow(int_type ch) override
+        {
+            if (finished)
+                return traits_type::eof();
+
+            hand_off();
+
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+
+            return traits_type::not_eof(ch);
+        }
+
+        /* Deliberately a no-op: flushing the stream does not write anything. Blocks are only handed off when the put
+         * area is full, so that all but the last block hold block_size bytes (virtual_offset() relies on this);
+         * the remaining data is written by finish().
+         */
+        int sync() override { return 0; }
+
+        void finish()
+        {
+            if (finished)
+                return;
+            finished = true;
+
+            hand_off();
+            wait();
+            block_offsets.push_back(offset);
+
+            static constexpr unsigned char eof_block[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 66, 67,
+                                                            2,  0,   27, 0, 3, 0, 0, 0, 0, 0,   0, 0, 0,  0};
+            out->write(reinterpret_cast<char const *>(eof_block), sizeof(eof_block));
+            close_output_stream(*out);
+        }
+    };
+
+    bgzf_streambuf buf;
+};
+
+// the header of a BGZF block (gzip with the "BC" extra field that holds the block size)
+inline constexpr size_t bgzf_header_size = 18;
+
+bool is_bgzf_header(std::span<char const> const header)
+{
+    auto byte = [&](size_t const i) { return static_cast<unsigned char>(header[i]); };
+
+    return header.size() >= bgzf_header_size && byte(0) == 31 && byte(1) == 139 && byte(2) == 8 && byte(3) == 4 &&
+           byte(10) == 6 && byte(11) == 0 && byte(12) == 'B' && byte(13) == 'C' && byte(14) == 2 && byte(15) == 0;
+}
+
+// whether the file starts with a BGZF block (and not with plain gzip or uncompressed data)
+bool is_bgzf_file(std::filesystem::path const & path)
+{
+    std::ifstream                      in{path, std::ios::binary};
+    std::array<char, bgzf_header_size> header{};
+    in.read(header.data(), header.size());
+    return in.gcount() == static_cast<std::streamsize>(header.size()) && is_bgzf_header(header);
+}
+
+// inflate a complete BGZF block into out and check its CRC32
+void bgzf_decompress_block(std::span<char const> const block, std::vector<char> & out)
+{
+    constexpr size_t footer_size = 8;
+
+    auto get_le = [&](size_t const pos, size_t const n_bytes)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < n_bytes; ++i)
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(block[pos + i])) << (8 * i);
+        return value;
+    };
+
+    if (block.size() < bgzf_header_size + footer_size)
+        throw delta_error{"Truncated BGZF block."};
+
+    uint32_t const crc  = get_le(block.size() - footer_size, 4);
+    uint32_t const size = get_le(block.size() - 4, 4);
+    if (size > 65536)
+        throw delta_error{"Invalid BGZF block."};
+
+    out.resize(size);
+
+    char const * const data      = block.data() + bgzf_header_size;
+    size_t const       data_size = block.size() - bgzf_header_size - footer_size;
+
+#ifdef BCFDELTA_HAVE_LIBDEFLATE
+    size_t                  actual_size = 0;
+    libdeflate_result const ret         = libdeflate_deflate_decompress(thread_libdeflate_decompressor(),
+                                                                        data,
+                                                                        data_size,
+                                                                        out.data(),
+                                                                        out.size(),
+                                                                        &actual_size);
+    bool const              ok          = ret == LIBDEFLATE_SUCCESS && actual_size == size;
+#else
+    z_stream zs{};
+    if (inflateInit2(&zs, -15) != Z_OK)
+        throw delta_error{"Could not initialise inflate."};
+
+    zs.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in  = data_size;
+    char dummy   = 0; // zlib does not accept a null output buffer, which empty blocks (the EOF marker) can have
+    zs.next_out  = reinterpret_cast<Bytef *>(size > 0 ? out.data() : &dummy);
+    zs.avail_out = out.size();
+
+    int const  ret = inflate(&zs, Z_FINISH);
+    bool const ok  = ret == Z_STREAM_END && zs.total_out == size;
+    inflateEnd(&zs);
+#endif
+
+    if (!ok)
+        throw delta_error{"Could not inflate BGZF block."};
+
+    if (crc32(crc32(0, nullptr, 0), reinterpret_cast<Bytef const *>(out.data()), out.size()) != crc)
+        throw delta_error{"CRC32 mismatch in BGZF block."};
+}
+
+/* Reads a BGZF-compressed stream. The compressed blocks are read in batches on the calling thread; the workers
+ * inflate a batch while the inflated data of the previous batch is being consumed. The get area is the inflated data
+ * of one block, so it is not copied again. Seeking is not supported.
+ */
+class bgzf_istream : public std::istream
+{
+public:
+    bgzf_istream(std::unique_ptr<std::istream> in, size_t const threads) :
+      std::istream{nullptr}, buf{std::move(in), std::max<size_t>(threads, 1)}
+    {
+        rdbuf(&buf);
+        exceptions(std::ios_base::badbit);
+    }
+
+private:
+    struct bgzf_streambuf : public std::streambuf
+    {
+        std::unique_ptr<std::istream> in;
+        size_t const                  threads;
+        size_t const                  batch_size; // blocks read at a time
+
+        std::vector<std::vector<char>> compressed; // the blocks being inflated
+        std::vector<std::vector<char>> inflated;   // their data
+        std::vector<std::vector<char>> ready;      // the inflated blocks that are being read
+        size_t                         n_ready = 0;
+        size_t                         next    = 0; // next block in ready
+        bool                           started = false;
+
+        /* Every worker inflates every threads-th block of compressed. The members below are guarded by mutex. */
+        std::vector<std::thread> workers;
+        std::mutex               mutex;
+        std::condition_variable  cv_work;
+        std::condition_variable  cv_done;
+        uint64_t                 generation = 0; // incremented for every hand-off
+        size_t                   n_blocks   = 0; // in compressed
+        size_t                   running    = 0; // workers that have not finished the current hand-off
+        bool                     stop       = false;
+        std::exception_ptr       error;
+
+        bgzf_streambuf(std::unique_ptr<std::istream> in, size_t const threads) :
+          in{std::move(in)}, threads{threads}, batch_size{4 * threads}, compressed(batch_size), inflated(batch_size)
+        {
+            setg(nullptr, nullptr, nullptr);
+
+            for (size_t t = 0; t < threads; ++t)
+                workers.emplace_back([this, t] { work(t); });
+        }
+
+        ~bgzf_streambuf()
+        {
+            {
+                std::unique_lock lock{mutex};
+                cv_done.wait(lock, [this] { return running == 0; });
+                stop = true;
+            }
+            cv_work.notify_all();
+
+            for (std::thread & worker : workers)
+                worker.join();
+        }
+
+        void work(size_t const first)
+        {
+            uint64_t seen = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock lock{mutex};
+                    cv_work.wait(lock, [&] { return stop || generation != seen; });
+                    if (stop)
+                        return;
+                    seen = generation;
+                }
+
+                std::exception_ptr e;
+                try
+                {
+                    for (size_t b = first; b < n_blocks; b += threads)
+                        bgzf_decompress_block(compressed[b], inflated[b]);
+                }
+                catch (...)
+                {
+                    e = std::current_exception();
+                }
+
+                {
+                    std::lock_guard lock{mutex};
+                    if (e && !error)
+                        error = e;
+                    --running;
+                }
+                cv_done.notify_all();
+            }
+        }
+
+        // read the next batch of compressed blocks and hand it to the workers
+        void read_batch()
+        {
+            size_t n = 0;
+            for (; n < batch_size; ++n)
+            {
+                std::vector<char> & block = compressed[n];
+                block.resize(bgzf_header_size);
+                in->read(block.data(), bgzf_header_size);
+                if (in->gcount() == 0)
+                    break;
+                if (in->gcount() != static_cast<std::streamsize>(bgzf_header_size) || !is_bgzf_header(block))
+                    throw delta_error{"The input is not BGZF-compressed or truncated."};
+
+                // BSIZE is the size of the block minus one
+                size_t const size =
+                  (static_cast<unsigned char>(block[16]) | static_cast<unsigned char>(block[17]) << 8) + 1;
+                if (size < bgzf_header_size)
+                    throw delta_error{"Invalid BGZF block."};
+
+                block.resize(size);
+                in->read(block.data() + bgzf_header_size, size - bgzf_header_size);
+                if (in->gcount() != static_cast<std::streamsize>(size - bgzf_header_size))
+                    throw delta_error{"Truncated BGZF block."};
+            }
+
+            {
+                std::lock_guard lock{mutex};
+                n_blocks = n;
+                running  = workers.size();
+                ++generation;
+            }
+            cv_work.notify_all();
+        }
+
+        // wait until the handed-off batch is inflated; rethrows errors of the workers
+        void wait()
+        {
+            std::unique_lock lock{mutex};
+            cv_done.wait(lock, [this] { return running == 0; });
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        // make the inflated batch readable and start inflating the next one; false at the end of the input
+        bool next_batch()
+        {
+            if (!started)
+            {
+                read_batch();
+                started = true;
+            }
+
+            wait();
+            if (n_blocks == 0)
+                return false;
+
+            std::swap(ready, inflated);
+            n_ready = n_blocks;
+            next    = 0;
+            if (inflated.size() < batch_size)
+                inflated.resize(batch_size);
+
+            read_batch();
+            return true;
+        }
+
+        int_type underflow() override
+        {
+            while (gptr() == egptr())
+            {
+                if (next < n_ready) // blocks can be empty, e.g. the EOF marker
+                {
+                    std::vector<char> & block = ready[next++];
+                    setg(block.data(), block.data(), block.data() + block.size());
+                }
+                else if (!next_batch())
+                {
+                    return traits_type::eof();
+                }
+            }
+
+            return traits_type::to_int_type(*gptr());
+        }
+    };
+
+    bgzf_streambuf buf;
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <zlib.h>
+
+#include <seqan3/alphabet/concept.hpp>
+
+#include <bio/var_io/reader.hpp>
+
+#include "shared.hpp"
+
+/* A representation of a record that is independent of the integer width of the fields, because the width may
+ * change during encoding/decoding. All fields are included; the DELTA_* INFO fields are skipped, as they differ
+ * between the original and the decoded record.
+ */
+struct record_normaliser
+{
+    std::string & out;
+
+    void append(auto const & value)
+    {
+        using value_t = std::remove_cvref_t<decltype(value)>;
+
+        if constexpr (std::same_as<value_t, bool> || std::same_as<value_t, char>)
+        {
+            out.push_back(static_cast<char>(value));
+        }
+        else if constexpr (std::same_as<value_t, float>)
+        {
+            out.append(reinterpret_cast<char const *>(&value), sizeof(float));
+        }
+        else if constexpr (std::integral<value_t>)
+        {
+            int32_t const i =
+              value == bio::var_io::missing_value<value_t> ? bio::var_io::missing_value<int32_t> : value;
+            out.append(reinterpret_cast<char const *>(&i), sizeof(int32_t));
+        }
+        else if constexpr (seqan3::alphabet<value_t>) // REF
+        {
+            out.push_back(seqan3::to_char(value));
+        }
+        else if constexpr (std::ranges::range<value_t>)
+        {
+            uint32_t const size = std::ranges::size(value);
+            out.append(reinterpret_cast<char const *>(&size), sizeof(uint32_t));
+            for (auto && elem : value)
+                append(elem);
+        }
+        else
+        {
+            static_assert(std::same_as<value_t, void>, "Unhandled type in record_normaliser.");
+        }
+    }
+
+    void operator()(bio::var_io::default_record<> const & record)
+    {
+        append(record.chrom());
+        append(record.pos());
+        append(record.id());
+        append(record.ref());
+        append(record.alt());
+        append(record.qual());
+        append(record.filter());
+
+        for (auto const & info : record.info())
+        {
+            if (info.id.starts_with("DELTA_"))
+                continue;
+
+            append(info.id);
+            std::visit([&](auto const & value) { append(value); }, info.value);
+        }
+
+        for (auto const & genotype : record.genotypes())
+        {
+            append(genotype.id);
+            std::visit([&](auto const & value) { append(value); }, genotype.value);
+        }
+    }
+};
+
+// CRC32 over the normalised records of one block (a reference record and all records up to the next reference)
+struct block_checksum_t
+{
+    std::string buffer;
+    uLong       crc = crc32(0L, Z_NULL, 0);
+
+    void add(bio::var_io::default_record<> const & record)
+    {
+        buffer.clear();
+        record_normaliser{buffer}(record);
+        crc = crc32(crc, reinterpret_cast<Bytef const *>(buffer.data()), buffer.size());
+    }
+
+    // returns the checksum of the block and resets the state
+    std::string finish()
+    {
+        std::string ret(8, '0');
+        std::snprintf(ret.data(), ret.size() + 1, "%08lx", crc & 0xFFFFFFFFul);
+        crc = crc32(0L, Z_NULL, 0);
+        return ret;
+    }
+};
+
+/* Validates the checksums of decoded blocks on worker threads. Every block starts at its anchor and its checksum only
+ * covers its own records, so blocks are checked independently of each other while decoding continues. Records are
+ * swapped into recycled blocks, so that their buffers are reused.
+ */
+class block_checker_t
+{
+public:
+    explicit block_checker_t(size_t const n_threads) : max_queue_size{2 * std::max<size_t>(n_threads, 1)}
+    {
+        for (size_t t = 0; t < std::max<size_t>(n_threads, 1); ++t)
+            workers.emplace_back([this] { run(); });
+    }
+
+    ~block_checker_t() { stop(); }
+
+    // add a decoded record to the current block; the record is copied if it is still needed, otherwise swapped
+    void add(bio::var_io::default_record<> & record, bool const still_needed)
+    {
+        if (!current)
+            current = take_block();
+
+        if (current->n == current->records.size())
+            current->records.emplace_back();
+
+        if (still_needed)
+            current->records[current->n] = record;
+        else
+            std::swap(current->records[current->n], record); // record gets the buffers of a checked record
+        ++current->n;
+    }
+
+    // the current block ends with the last added record; blocks while the queue is full; throws earlier mismatches
+    void end_block(std::string expected_sum)
+    {
+        if (!current)
+            current = take_block();
+        current->expected_sum = std::move(expected_sum);
+        current->index        = n_blocks++;
+
+        {
+            std::unique_lock lock{mutex};
+            cv_space.wait(lock, [this] { return queue.size() < max_queue_size || !error.empty(); });
+
+            if (!error.empty())
+                throw delta_error{error};
+
+            queue.push_back(std::move(current));
+        }
+        cv_work.notify_one();
+    }
+
+    // wait for all blocks to be checked; throws the mismatch of the first block in file order that failed
+    void finish()
+    {
+        stop();
+
+        if (!error.empty())
+            throw delta_error{error};
+    }
+
+private:
+    struct block_t
+    {
+        std::vector<bio::var_io::default_record<>> records; // only the first n are part of the block
+        size_t                                     n     = 0;
+        size_t                                     index = 0;
+        std::string                                expected_sum;
+    };
+
+    std::unique_ptr<block_t> take_block()
+    {
+        std::lock_guard lock{mutex};
+
+        if (pool.empty())
+            return std::unique_ptr<block_t>{new block_t{}};
+
+        std::unique_ptr<block_t> block = std::move(pool.back());
+        pool.pop_back();
+        block->n = 0;
+        return block;
+    }
+
+    void run()
+    {
+        block_checksum_t checksum;
+
+        while (true)
+        {
+            std::unique_ptr<block_t> block;
+
+            {
+                std::unique_lock lock{mutex};
+                cv_work.wait(lock, [this] { return !queue.empty() || done; });
+
+                if (queue.empty()) // done
+                    return;
+
+                block = std::move(queue.front());
+                queue.pop_front();
+            }
+            cv_space.notify_one();
+
+            for (size_t k = 0; k < block->n; ++k)
+                checksum.add(block->records[k]);
+
+            if (std::string const actual_sum = checksum.finish(); actual_sum != block->expected_sum)
+            {
+                std::string position = "the start of the file";
+                if (block->n > 0)
+                {
+                    bio::var_io::default_record<> const & last = block->records[block->n - 1];
+                    position = last.chrom() + ":" + std::to_string(last.pos());
+                }
+
+                delta_error const mismatch{"Checksum mismatch in block ending at ",
+                                           position,
+                                           ". Expected: ",
+                                           block->expected_sum,
+                                           ". Got: ",
+                                           actual_sum,
+                                           "."};
+
+                std::lock_guard lock{mutex};
+                if (error.empty() || block->index < error_index)
+                {
+                    error       = mismatch.what();
+                    error_index = block->index;
+                }
+                cv_space.notify_all();
+            }
+
+            std::lock_guard lock{mutex};
+            pool.push_back(std::move(block));
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard lock{mutex};
+            done = true;
+        }
+        cv_work.notify_all();
+
+        for (std::thread & worker : workers)
+            if (worker.joinable())
+                worker.join();
+    }
+
+    size_t const             max_queue_size;
+    std::unique_ptr<block_t> current; // only accessed by the decoding thread
+    size_t                   n_blocks = 0;
+
+    std::mutex                            mutex;
+    std::condition_variable               cv_work;
+    std::condition_variable               cv_space;
+    std::deque<std::unique_ptr<block_t>>  queue;
+    std::vector<std::unique_ptr<block_t>> pool;
+    std::string                           error;
+    size_t                                error_index = 0;
+    bool                                  done        = false;
+
+    std::vector<std::thread> workers;
+};
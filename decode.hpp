@@ -5,13 +5,31 @@
 #include <bio/var_io/reader.hpp>
 #include <bio/var_io/writer.hpp>
 
+#include "checksum.hpp"
+#include "io.hpp"
+#include "kernels.hpp"
+#include "memory.hpp"
+#include "predict.hpp"
 #include "shared.hpp"
+#include "trace.hpp"
 
 struct decode_options_t
 {
     std::filesystem::path input;
     std::filesystem::path output;
-    size_t                threads = std::max<size_t>(1, std::min<size_t>(8, std::thread::hardware_concurrency()));
+    std::string           output_type;
+    bool                  check       = false;
+    bool                  mmap        = false;
+    int                   level       = -1;
+    std::string           profile     = "balanced";
+    bool                  io_uring    = false;
+    unsigned              read_ahead  = 8;
+    size_t                max_memory  = 0;
+    bool                  write_index = false;
+    size_t                threads     = std::max<size_t>(1, std::min<size_t>(8, std::thread::hardware_concurrency()));
+
+    std::filesystem::path trace;
+    bool                  trace_counters = false;
 };
 
 decode_options_t parse_decode_arguments(seqan3::argument_parser & parser)
@@ -19,17 +37,25 @@ decode_options_t parse_decode_arguments(seqan3::argument_parser & parser)
     parser.info.short_description = "Losslessly compress VCF and BCF files (decompression sub-program).";
     parser.info.version           = version;
     parser.info.date              = date;
-    parser.info.synopsis.push_back("bcfdelta decode input_file[.vcf.gz|.bcf] output_file[.vcf.gz|.bcf]");
+    parser.info.synopsis.push_back("bcfdelta decode input_file[.vcf.gz|.bcf|-] output_file[.vcf.gz|.bcf|-]");
 
     decode_options_t options{};
 
     parser.add_positional_option(options.input,
-                                 "The input file.",
-                                 seqan3::input_file_validator{
-                                   {"vcf", "vcf.gz", "bcf"}
-    });
+                                 "The input file (\"-\" for stdin).",
+                                 input_path_validator{});
     parser.add_positional_option(options.output,
-                                 "The output file."); //, seqan3::output_file_validator{{"vcf", "vcf.gz", "bcf"}});
+                                 "The output file (\"-\" for stdout).");
+
+    add_output_type_option(parser, options.output_type);
+
+    add_write_index_option(parser, options.write_index);
+
+    parser.add_option(options.check,
+                      'c',
+                      "check",
+                      "Validate the block checksums (requires a file encoded with --checksum). Blocks are validated "
+                      "in parallel on a third of the threads while decoding continues.");
 
     parser.add_subsection("Performance:");
 
@@ -40,123 +66,49 @@ decode_options_t parse_decode_arguments(seqan3::argument_parser & parser)
                       seqan3::option_spec::standard,
                       seqan3::arithmetic_range_validator{1u, std::thread::hardware_concurrency() * 2});
 
+    add_compression_options(parser, options.level, options.profile);
+
+    parser.add_option(options.mmap,
+                      '\0',
+                      "mmap",
+                      "Memory-map the input file (local files only). This only saves the read() calls; it is not "
+                      "zero-copy, the data is still copied when it is decompressed and parsed.");
+
+    add_io_uring_options(parser, options.io_uring, options.read_ahead);
+
+    parser.add_option(options.max_memory,
+                      '\0',
+                      "max-memory",
+                      "Try to stay within this many MiB by keeping only the state that is needed for decoding "
+                      "subsequent records. Reports the peak memory usage. 0 means no limit.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{0, 16 * 1024 * 1024});
+
+    add_trace_options(parser, options.trace, options.trace_counters);
+
     parser.parse();
 
     return options;
 }
 
-void undo_delta(bio::var_io::default_record<> const &                  ref_record,
-                bio::var_io::default_record<> &                        record,
-                bio::var_io::header const &                            in_hdr,
-                std::vector<int32_t> &                                 vec32_buffer,
-                seqan3::concatenated_sequences<std::vector<int32_t>> & vecvec32_buffer)
+void undo_info_delta(bio::var_io::default_record<> const & ref_record,
+                     bio::var_io::default_record<> &       record,
+                     format_plan_t const &                 plan)
 {
-    for (auto it = record.genotypes().begin(); it != record.genotypes().end(); ++it)
+    for (auto it = record.info().begin(); it != record.info().end(); ++it)
     {
-        bio::var_io::header::format_t const & format = in_hdr.formats[in_hdr.string_to_format_pos().at(it->id)];
-
-        if (!format.other_fields.contains("Encoding") || format.other_fields.at("Encoding") != "Delta")
+        int32_t const * number = plan.find_info(it->id);
+        if (number == nullptr)
             continue;
 
-        for (auto lit = ref_record.genotypes().begin(); lit != ref_record.genotypes().end(); ++lit)
+        for (auto lit = ref_record.info().begin(); lit != ref_record.info().end(); ++lit)
         {
             if (it->id == lit->id)
             {
-                if (!bio::detail::type_id_is_compatible(bio::var_io::value_type_id{it->value.index()},
-                                                        bio::var_io::value_type_id{lit->value.index()}))
-                {
-                    throw std::runtime_error{"Incompatible types in variants"};
-                }
-
-                auto get_max = bio::detail::overloaded{
-                  [](auto const &)
-                  {
-                      throw delta_error{"Unreachable"};
-                      return int64_t{};
-                  },
-                  []<std::integral T>(std::vector<T> const & values) { return (int64_t)std::ranges::max(values); },
-                  []<typename T>(seqan3::concatenated_sequences<std::vector<T>> const & values)
-                  { return (int64_t)std::ranges::max(values.concat()); }};
-
-                // this heuristic is not tight
-                int64_t plus_max = std::visit(get_max, it->value) + std::visit(get_max, lit->value);
-
-                // current vector might be over int8 while values might become int32
-                switch (bio::var_io::value_type_id{it->value.index()})
-                {
-                    case bio::var_io::value_type_id::int8:
-                        if (plus_max <= std::numeric_limits<int8_t>::max())
-                            break;
-                        [[fallthrough]];
-                    case bio::var_io::value_type_id::int16:
-                        {
-                            if (plus_max <= std::numeric_limits<int16_t>::max())
-                                break;
-                            auto fun = [&](auto & rng)
-                            {
-                                using rng_t = decltype(rng);
-                                if constexpr (std::same_as<rng_t, std::vector<int8_t> &> ||
-                                              std::same_as<rng_t, std::vector<int16_t> &>)
-                                {
-                                    bio::detail::sized_range_copy(rng, vec32_buffer);
-                                }
-                                else
-                                {
-                                    throw delta_error{"Bug encountered, please report:\n",
-                                                      __FILE__,
-                                                      ": ",
-                                                      __LINE__,
-                                                      "\n",
-                                                      __PRETTY_FUNCTION__};
-                                }
-                            };
-
-                            std::visit(fun, it->value);
-                            it->value = std::move(vec32_buffer);
-                            break;
-                        }
-                    case bio::var_io::value_type_id::vector_of_int8:
-                        if (plus_max <= std::numeric_limits<int8_t>::max())
-                            break;
-                        [[fallthrough]];
-                    case bio::var_io::value_type_id::vector_of_int16:
-                        {
-                            if (plus_max <= std::numeric_limits<int16_t>::max())
-                                break;
-                            auto fun = [&](auto & rng)
-                            {
-                                using rng_t = decltype(rng);
-                                if constexpr (std::same_as<rng_t,
-                                                           seqan3::concatenated_sequences<std::vector<int8_t>> &> ||
-                                              std::same_as<rng_t,
-                                                           seqan3::concatenated_sequences<std::vector<int16_t>> &>)
-                                {
-                                    vecvec32_buffer.clear();
-                                    vecvec32_buffer.reserve(rng.size());
-                                    vecvec32_buffer.concat_reserve(rng.concat_size());
-                                    for (size_t i = 0; i < std::ranges::size(rng); ++i)
-                                        vecvec32_buffer.push_back(rng[i]);
-                                }
-                                else
-                                {
-                                    throw delta_error{"Bug encountered, please report:\n",
-                                                      __FILE__,
-                                                      ": ",
-                                                      __LINE__,
-                                                      "\n",
-                                                      __PRETTY_FUNCTION__};
-                                }
-                            };
-
-                            std::visit(fun, it->value);
-                            it->value = std::move(vecvec32_buffer);
-                            break;
-                        }
-                    default:
-                        break;
-                }
-
-                delta_visitor<std::plus<>> visitor{it->id, format.number, record.alt().size(), &in_hdr};
+                // residuals are stored in the smallest suitable width but were computed in int32_t
+                widen_to_int32(it->value);
+
+                info_delta_visitor<std::plus<>> visitor{it->id, *number, record.alt().size()};
 
                 std::visit(visitor, lit->value, it->value);
                 break;
@@ -165,22 +117,143 @@ void undo_delta(bio::var_io::default_record<> const &                  ref_recor
     }
 }
 
+// read and remove the INFO field that lists the replaced samples of a STRING field; false if there is none
+bool take_same_runs(bio::var_io::default_record<> & record, std::string_view const same_id, std::vector<int32_t> & runs)
+{
+    auto it = std::ranges::find_if(record.info(), [&](auto const & info) { return info.id == same_id; });
+    if (it == record.info().end())
+        return false;
+
+    auto fun = [&]<typename value_t>(value_t const & value)
+    {
+        if constexpr (std::integral<value_t> && !std::same_as<value_t, bool> && !std::same_as<value_t, char>)
+            runs.assign(1, value);
+        else if constexpr (numeric_range<value_t> && std::integral<std::ranges::range_value_t<value_t>>)
+            runs.assign(std::ranges::begin(value), std::ranges::end(value));
+        else
+            throw delta_error{"The INFO field ", same_id, " does not hold integers."};
+    };
+
+    std::visit(fun, it->value);
+    record.info().erase(it);
+    return true;
+}
+
+void undo_delta(bio::var_io::default_record<> const & ref_record,
+                bio::var_io::default_record<> &       record,
+                format_plan_t const &                 plan)
+{
+    undo_info_delta(ref_record, record, plan);
+
+    std::vector<int32_t> same_runs;
+
+    for (format_plan_t::match_t const & match : plan.resolve(ref_record, record))
+    {
+        auto const & ref = ref_record.genotypes()[match.last_pos];
+        auto &       cur = record.genotypes()[match.cur_pos];
+
+        if (match.field->is_string && !take_same_runs(record, match.field->same_id, same_runs))
+            continue; // no value was replaced
+
+        BCFDELTA_TRACE_SCOPE(match.field->name.c_str());
+
+        // residuals are stored in the smallest suitable width but were computed in int32_t
+        {
+            BCFDELTA_TRACE_SCOPE("undo_delta (widen)");
+            widen_to_int32(cur.value);
+        }
+
+        plan.run<std::plus<>, true>(*match.field,
+                                    cur.id,
+                                    record.alt().size(),
+                                    ref.value,
+                                    cur.value,
+                                    0,
+                                    std::numeric_limits<size_t>::max(),
+                                    &same_runs);
+    }
+}
+
+// decodes records in the order of the file and keeps track of the reference record
+struct record_decoder_t
+{
+    bio::var_io::header const & in_hdr;
+
+    bio::var_io::default_record<> ref_record;
+    format_plan_t                 plan{in_hdr};
+    predictor_t                   predictor{in_hdr};
+    std::string                   block_sum; // DELTA_SUM of the last decoded record (empty if it does not end a block)
+
+    // decodes the record in-place and returns whether it is a reference for subsequent records
+    bool decode(bio::var_io::default_record<> & record)
+    {
+        bool needs_decompression = false;
+        bool is_anchor           = false;
+        bool is_reference        = false;
+        block_sum.clear();
+
+        for (bio::var_io::info_element<bio::ownership::deep> const & info : record.info())
+        {
+            if (info.id == "DELTA_REF")
+                is_anchor = is_reference = true;
+            else if (info.id == "DELTA_SUM")
+                block_sum = std::get<std::string>(info.value);
+            else if (info.id == "DELTA_COMP")
+            {
+                needs_decompression = true;
+                if (record.alt().size() == 1) // multi-allelic are never reference
+                    is_reference = true;
+            }
+        }
+
+        std::erase_if(record.info(),
+                      [](auto const & info)
+                      { return info.id == "DELTA_REF" || info.id == "DELTA_COMP" || info.id == "DELTA_SUM"; });
+
+        if (needs_decompression)
+        {
+            BCFDELTA_TRACE_SCOPE("undo_delta");
+            undo_delta(ref_record, record, plan);
+        }
+
+        if (needs_decompression || is_anchor)
+            predictor.decode(record, is_anchor);
+
+        return is_reference;
+    }
+};
+
 void decode(decode_options_t const & options)
 {
+    start_tracing(options.trace, options.trace_counters);
+
     size_t threads        = options.threads - 1; // subtract one for the main thread
     size_t reader_threads = threads / 3;
-    size_t writer_threads = threads - reader_threads;
+    size_t check_threads  = options.check ? std::max<size_t>(threads / 3, 1) : 0;
+    size_t writer_threads = threads - reader_threads - std::min(check_threads, threads - reader_threads);
 
     auto reader_options =
       bio::var_io::reader_options{.field_types    = bio::var_io::field_types<bio::ownership::deep>,
                                   .stream_options = bio::transparent_istream_options{.threads = reader_threads + 1}};
 
-    bio::var_io::reader reader{options.input, reader_options};
+    unsigned const io_uring_depth = options.io_uring ? options.read_ahead : 0;
+
+    std::unique_ptr<std::istream> input_stream;
+    auto                          reader =
+      make_reader(options.input, reader_options, options.mmap, input_stream, io_uring_depth);
 
     auto writer_options =
       bio::var_io::writer_options{.stream_options = bio::transparent_ostream_options{.threads = writer_threads + 1}};
+    writer_options.stream_options.compression_level = compression_level(options.level, options.profile);
 
-    bio::var_io::writer writer{options.output};
+    std::unique_ptr<std::ostream> output_stream;
+    std::optional                 writer{make_writer(options.output,
+                                                     options.output_type,
+                                                     writer_options,
+                                                     output_stream,
+                                                     io_uring_depth,
+                                                     options.write_index,
+                                                     options.profile == "fast")};
 
     bio::var_io::header const & in_hdr  = reader.header();
     bio::var_io::header         out_hdr = in_hdr;
@@ -191,10 +264,19 @@ void decode(decode_options_t const & options)
         std::exit(1);
     }
 
+    if (options.check && !out_hdr.string_to_info_pos().contains("DELTA_SUM"))
+    {
+        std::cerr << "The input file does not contain checksums. Exiting.\n";
+        std::exit(1);
+    }
+
     /** clean up the out-header **/
     std::erase_if(out_hdr.infos,
                   [](bio::var_io::header::info_t const & info)
-                  { return info.id == "DELTA_COMP" || info.id == "DELTA_REF"; });
+                  {
+                      return info.id == "DELTA_COMP" || info.id == "DELTA_REF" || info.id == "DELTA_SUM" ||
+                             info.id.starts_with("DELTA_SAME_");
+                  });
 
     for (bio::var_io::header::format_t & format : out_hdr.formats)
     {
@@ -202,46 +284,63 @@ void decode(decode_options_t const & options)
             format.other_fields.erase("Encoding");
     }
 
-    writer.set_header(out_hdr);
+    for (bio::var_io::header::info_t & info : out_hdr.infos)
+    {
+        if (info.other_fields.contains("Encoding"))
+            info.other_fields.erase("Encoding");
+    }
+
+    writer->set_header(out_hdr);
 
     /** decode **/
-    bio::var_io::default_record<>                        ref_record;
-    // TODO these buffers don't work as expected
-    std::vector<int32_t>                                 vec32_buffer;
-    seqan3::concatenated_sequences<std::vector<int32_t>> vecvec32_buffer;
+    record_decoder_t decoder{.in_hdr = in_hdr};
+
+    // blocks are validated on separate threads while decoding continues
+    std::optional<block_checker_t> checker;
+    if (options.check)
+        checker.emplace(check_threads);
 
     // TODO add check that first record is REF
-    for (bio::var_io::default_record<> & record : reader)
+    for (auto it = reader.begin(); it != reader.end();)
     {
-        bool needs_decompression = false;
-        bool is_reference        = false;
+        bio::var_io::default_record<> & record = *it;
 
-        for (bio::var_io::info_element<bio::ownership::deep> const & info : record.info())
-        {
-            if (info.id == "DELTA_REF")
-                is_reference = true;
+        bool const is_reference = decoder.decode(record);
 
-            if (info.id == "DELTA_COMP")
-            {
-                needs_decompression = true;
-                if (record.alt().size() == 1) // multi-allelic are never reference
-                    is_reference = true;
-                break;
-            }
+        {
+            BCFDELTA_TRACE_SCOPE("write");
+            writer->push_back(record);
         }
 
-        std::erase_if(record.info(),
-                      [](auto const & info) { return info.id == "DELTA_REF" || info.id == "DELTA_COMP"; });
-
-        if (needs_decompression)
-            undo_delta(ref_record, record, in_hdr, vec32_buffer, vecvec32_buffer);
-
-        writer.push_back(record);
+        if (checker)
+        {
+            BCFDELTA_TRACE_SCOPE("check");
+            checker->add(record, is_reference);
+            if (!decoder.block_sum.empty())
+                checker->end_block(std::move(decoder.block_sum));
+        }
 
         if (is_reference)
         {
             // backup the record to be able to refer to it next iteration
-            ref_record = std::move(record);
+            if (options.max_memory > 0)
+                copy_reference_state(record, decoder.ref_record, decoder.plan);
+            else
+                decoder.ref_record = std::move(record);
         }
+
+        BCFDELTA_TRACE_SCOPE("read");
+        ++it;
     }
+
+    if (checker)
+        checker->finish();
+
+    writer.reset();
+    finish_output(output_stream);
+
+    finish_tracing(options.trace);
+
+    if (options.max_memory > 0)
+        report_memory(options.max_memory);
 }
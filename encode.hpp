@@ -5,22 +5,50 @@
 #include <bio/var_io/reader.hpp>
 #include <bio/var_io/writer.hpp>
 
+#include "encode_auto.hpp"
 #include "encode_delta.hpp"
 #include "encode_split.hpp"
+#include "io.hpp"
+#include "memory.hpp"
+#include "predict.hpp"
 #include "shared.hpp"
+#include "trace.hpp"
+#include "verify.hpp"
 
 struct encode_options_t
 {
     std::filesystem::path input;
     std::filesystem::path output;
+    std::string           output_type;
     uint64_t              ref_freq         = 10'000;
     bool                  delta_compress   = true;
     bool                  split_fields     = false;
     bool                  compress_ints    = true;
     bool                  compress_floats  = false;
     bool                  compress_chars   = false;
+    bool                  compress_strings = false;
+    bool                  compress_gt      = false;
+    bool                  compress_info    = false;
     bool                  skip_problematic = true;
+    bool                  auto_tune        = false;
+    size_t                auto_sample      = 1'000;
+    bool                  verify           = false;
+    bool                  checksum         = false;
+    bool                  mmap             = false;
+    int                   level            = -1;
+    std::string           profile          = "balanced";
+    bool                  io_uring         = false;
+    unsigned              read_ahead       = 8;
+    size_t                batch_size       = 0;
+    size_t                tile_size        = 256;
+    size_t                max_memory       = 0;
+    bool                  write_index      = false;
     size_t                threads = std::max<size_t>(2, std::min<size_t>(8, std::thread::hardware_concurrency()));
+
+    std::vector<std::string> predictors; // FIELD=PREDICTOR
+
+    std::filesystem::path trace;
+    bool                  trace_counters = false;
 };
 
 encode_options_t parse_encode_arguments(seqan3::argument_parser & parser)
@@ -28,17 +56,19 @@ encode_options_t parse_encode_arguments(seqan3::argument_parser & parser)
     parser.info.short_description = "Losslessly compress VCF and BCF files.";
     parser.info.version           = version;
     parser.info.date              = date;
-    parser.info.synopsis.push_back("bcfdelta encode input_file[.vcf.gz|.bcf] output_file[.vcf.gz|.bcf]");
+    parser.info.synopsis.push_back("bcfdelta encode input_file[.vcf.gz|.bcf|-] output_file[.vcf.gz|.bcf|-]");
 
     encode_options_t options{};
 
     parser.add_positional_option(options.input,
-                                 "The input file.",
-                                 seqan3::input_file_validator{
-                                   {"vcf", "vcf.gz", "bcf"}
-    });
+                                 "The input file (\"-\" for stdin).",
+                                 input_path_validator{});
     parser.add_positional_option(options.output,
-                                 "The output file."); //, seqan3::output_file_validator{{"vcf", "vcf.gz", "bcf"}});
+                                 "The output file (\"-\" for stdout).");
+
+    add_output_type_option(parser, options.output_type);
+
+    add_write_index_option(parser, options.write_index);
 
     parser.add_subsection("Which data to compress:");
 
@@ -66,11 +96,56 @@ encode_options_t parse_encode_arguments(seqan3::argument_parser & parser)
                       "compress-chars",
                       "Delta-compress characters (this does not refer to STRING fields, just to CHAR fields).");
 
+    parser.add_option(options.compress_strings,
+                      '\0',
+                      "compress-strings",
+                      "Replace STRING values in FORMAT fields that are equal to the previous record's value by \".\" "
+                      "and list the replaced samples in a DELTA_SAME_<ID> INFO field (also with --auto, only if "
+                      "given).");
+
+    parser.add_option(options.compress_gt,
+                      '\0',
+                      "compress-gt",
+                      "Delta-compress genotypes (the reference's allele is swapped with 0, phase changes are marked). "
+                      "Off by default, because it changes the genotypes that tools see without decoding (also with "
+                      "--auto, only if given).");
+
+    parser.add_option(options.compress_info,
+                      '\0',
+                      "compress-info",
+                      "Also compress numeric INFO fields (the above options apply to INFO fields, too). Off by "
+                      "default, because it changes the INFO values that tools see without decoding.");
+
+    parser.add_option(options.predictors,
+                      '\0',
+                      "predictor",
+                      "Predict an integer FORMAT field from the previous records of the block instead of using the "
+                      "previous record's value, e.g. \"DP=MovingAvg4\" or \"GQ=Linear\". Can be given multiple times.");
+
     parser.add_option(options.skip_problematic,
                       '\0',
                       "skip-problematic",
                       "Skip sub-ranges that do not have expected size.");
 
+    parser.add_option(options.auto_tune,
+                      '\0',
+                      "auto",
+                      "Decide which fields to delta-compress and whether to split fields by trial-encoding the first "
+                      "records. Overrides the options above.");
+
+    parser.add_subsection("Validation:");
+
+    parser.add_option(options.verify,
+                      '\0',
+                      "verify",
+                      "Decode every record on a separate thread and compare it to the original (no extra output). "
+                      "The verification lags behind by at most --batch-size or --read-ahead records.");
+
+    parser.add_option(options.checksum,
+                      '\0',
+                      "checksum",
+                      "Store a checksum for every block of records (can be validated with decode --check).");
+
     parser.add_subsection("Performance:");
 
     parser.add_option(options.threads,
@@ -80,6 +155,40 @@ encode_options_t parse_encode_arguments(seqan3::argument_parser & parser)
                       seqan3::option_spec::standard,
                       seqan3::arithmetic_range_validator{2u, std::thread::hardware_concurrency() * 2});
 
+    add_compression_options(parser, options.level, options.profile);
+
+    parser.add_option(options.mmap,
+                      '\0',
+                      "mmap",
+                      "Memory-map the input file (local files only). This only saves the read() calls; it is not "
+                      "zero-copy, the data is still copied when it is decompressed and parsed.");
+
+    add_io_uring_options(parser, options.io_uring, options.read_ahead);
+
+    parser.add_option(options.batch_size,
+                      '\0',
+                      "batch-size",
+                      "Delta-compress up to N records between references at once, sample tile by sample tile, so that "
+                      "the values stay in cache. 0 disables batching.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{0, 100'000});
+
+    parser.add_option(options.tile_size,
+                      '\0',
+                      "tile-size",
+                      "Number of samples per tile in batch mode.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{1, 1'000'000});
+
+    parser.add_option(options.max_memory,
+                      '\0',
+                      "max-memory",
+                      "Stay within this many MiB by keeping only the state that is needed for delta-compression and by "
+                      "limiting batches and the --auto sample. Whenever the resident memory exceeds it, the batch size "
+                      "and the --verify queue are halved. Reports the peak memory usage. 0 means no limit.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{0, 16 * 1024 * 1024});
+
     parser.add_subsection("Tuning:");
 
     parser.add_option(options.ref_freq,
@@ -89,6 +198,15 @@ encode_options_t parse_encode_arguments(seqan3::argument_parser & parser)
                       seqan3::option_spec::standard,
                       seqan3::arithmetic_range_validator{100, 1'000'000});
 
+    parser.add_option(options.auto_sample,
+                      '\0',
+                      "auto-sample",
+                      "Number of records to trial-encode with --auto.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{10, 1'000'000});
+
+    add_trace_options(parser, options.trace, options.trace_counters);
+
     parser.parse();
 
     return options;
@@ -96,6 +214,8 @@ encode_options_t parse_encode_arguments(seqan3::argument_parser & parser)
 
 void encode(encode_options_t const & options)
 {
+    start_tracing(options.trace, options.trace_counters);
+
     size_t threads        = options.threads - 1; // subtract one for the main thread
     size_t reader_threads = threads / 3;
     size_t writer_threads = threads - reader_threads;
@@ -104,49 +224,74 @@ void encode(encode_options_t const & options)
       bio::var_io::reader_options{.field_types    = bio::var_io::field_types<bio::ownership::deep>,
                                   .stream_options = bio::transparent_istream_options{.threads = reader_threads + 1}};
 
-    bio::var_io::reader reader{options.input, reader_options};
+    unsigned const io_uring_depth = options.io_uring ? options.read_ahead : 0;
+
+    std::unique_ptr<std::istream> input_stream;
+    auto                          reader =
+      make_reader(options.input, reader_options, options.mmap, input_stream, io_uring_depth);
 
     auto writer_options =
       bio::var_io::writer_options{.stream_options = bio::transparent_ostream_options{.threads = writer_threads + 1}};
+    writer_options.stream_options.compression_level = compression_level(options.level, options.profile);
 
-    bio::var_io::writer writer{options.output, writer_options};
+    std::unique_ptr<std::ostream> output_stream;
+    std::optional                 writer{make_writer(options.output,
+                                                     options.output_type,
+                                                     writer_options,
+                                                     output_stream,
+                                                     io_uring_depth,
+                                                     options.write_index,
+                                                     options.profile == "fast")};
 
     // "out_hdr" is a copy of "in_hdr"
     auto hdr = reader.header();
 
-    if (options.split_fields)
+    // with a memory budget, batches and the sample for auto-tuning may use a quarter of it
+    bool const        bounded       = options.max_memory > 0;
+    size_t const      buffer_budget = options.max_memory * mebibyte / 4;
+    memory_governor_t governor{options.max_memory};
+
+    /* gather sample for auto-tuning */
+    std::vector<bio::var_io::default_record<>> sample;
+    auto                                       it = reader.begin();
+
+    auto_tune_result_t auto_result{};
+    if (options.auto_tune)
     {
-        // rename AD to AD_ALT
-        hdr.formats.push_back({.id          = "AD_ALT",
-                               .number      = bio::var_io::header_number::A,
-                               .type        = "Integer",
-                               .type_id     = bio::var_io::value_type_id::vector_of_int32,
-                               .description = "ALT entries of AD field."});
-
-        // add ad_ref
-        hdr.formats.push_back({.id          = "AD_REF",
-                               .number      = 1,
-                               .type        = "Integer",
-                               .type_id     = bio::var_io::value_type_id::int32,
-                               .description = "REF entry of AD field."});
-
-        hdr.formats.push_back({.id          = "PL1",
-                               .number      = 1,
-                               .type        = "Integer",
-                               .type_id     = bio::var_io::value_type_id::int32,
-                               .description = "PL values for 00."});
-
-        hdr.formats.push_back({.id          = "PL2",
-                               .number      = bio::var_io::header_number::A,
-                               .type        = "Integer",
-                               .type_id     = bio::var_io::value_type_id::vector_of_int32,
-                               .description = "PL values for ab where a == 0 and b >= 1."});
-
-        hdr.formats.push_back({.id          = "PL3",
-                               .number      = bio::var_io::header_number::dot,
-                               .type        = "Integer",
-                               .type_id     = bio::var_io::value_type_id::vector_of_int32,
-                               .description = "PL values for ab where a >= 1 and b >= 1"});
+        size_t sample_memory = 0;
+        for (; it != reader.end() && sample.size() < options.auto_sample; ++it)
+        {
+            if (bounded && !sample.empty() && sample_memory + record_memory(*it) > buffer_budget)
+                break;
+
+            sample.push_back(*it);
+            if (bounded)
+                sample_memory += record_memory(sample.back());
+        }
+
+        auto_result = auto_tune(sample, hdr, options.ref_freq, options.skip_problematic);
+    }
+
+    bool const split_fields = options.auto_tune ? auto_result.split_fields : options.split_fields;
+
+    if (split_fields)
+    {
+        add_split_formats(hdr);
+    }
+
+    // FORMAT field -> predictor
+    std::map<std::string, std::string> predictors;
+    for (std::string const & spec : options.predictors)
+    {
+        size_t const eq = spec.find('=');
+        if (eq == std::string::npos ||
+            std::ranges::find(predictor_names, std::string_view{spec}.substr(eq + 1)) == predictor_names.end())
+        {
+            std::cerr << "Invalid --predictor \"" << spec
+                      << "\"; expected FIELD=MovingAvg4 or FIELD=Linear. Exiting.\n";
+            std::exit(1);
+        }
+        predictors[spec.substr(0, eq)] = spec.substr(eq + 1);
     }
 
     if (options.delta_compress)
@@ -164,6 +309,8 @@ void encode(encode_options_t const & options)
                                              .type        = "Flag",
                                              .type_id     = bio::var_io::value_type_id::flag,
                                              .description = "Records with this flag have delta-compressed fields."};
+            // reanchor re-encodes records with the same setting
+            info.other_fields["SkipProblematic"] = options.skip_problematic ? "true" : "false";
             hdr.infos.push_back(std::move(info));
         }
 
@@ -178,7 +325,18 @@ void encode(encode_options_t const & options)
             hdr.infos.push_back(std::move(info));
         }
 
-        // all non-string fields are delta-compressed by default
+        if (options.checksum)
+        {
+            bio::var_io::header::info_t info{.id      = "DELTA_SUM",
+                                             .number  = 1,
+                                             .type    = "String",
+                                             .type_id = bio::var_io::value_type_id::string,
+                                             .description =
+                                               "Checksum of the decoded records since the last 'anchor' record."};
+            hdr.infos.push_back(std::move(info));
+        }
+
+        // FORMAT fields are delta-compressed according to their type; GT has its own codec
         for (bio::var_io::header::format_t & format : hdr.formats)
         {
             bool do_compress = false;
@@ -192,6 +350,80 @@ void encode(encode_options_t const & options)
                     do_compress = options.compress_floats;
                     break;
                 case bio::var_io::value_type_id::string:
+                case bio::var_io::value_type_id::vector_of_string:
+                    do_compress = format.id == "GT" ? options.compress_gt : options.compress_strings;
+                    break;
+                default: // integer cases
+                    do_compress = options.compress_ints;
+                    break;
+            }
+
+            if (options.auto_tune) // STRING fields and genotypes are opt-in
+                do_compress = auto_result.delta_fields.contains("FORMAT/" + format.id) &&
+                              (!is_string_format(format) || options.compress_strings) &&
+                              (format.id != "GT" || options.compress_gt);
+
+            if (auto pit = predictors.find(format.id); pit != predictors.end())
+            {
+                if (format.type_id != bio::var_io::value_type_id::int32 &&
+                    format.type_id != bio::var_io::value_type_id::vector_of_int32)
+                {
+                    std::cerr << "Predictors are only supported for integer fields, but " << format.id
+                              << " is not one. Exiting.\n";
+                    std::exit(1);
+                }
+
+                format.other_fields["Encoding"] = pit->second;
+                predictors.erase(pit);
+            }
+            else if (do_compress)
+            {
+                format.other_fields["Encoding"] = "Delta";
+            }
+        }
+
+        for (bio::var_io::header::format_t const & format : hdr.formats)
+        {
+            if (is_string_format(format) && format.other_fields.contains("Encoding") &&
+                format.other_fields.at("Encoding") == "Delta")
+            {
+                bio::var_io::header::info_t info{.id          = same_runs_id(format.id),
+                                                 .number      = bio::var_io::header_number::dot,
+                                                 .type        = "Integer",
+                                                 .type_id     = bio::var_io::value_type_id::vector_of_int32,
+                                                 .description = "Lengths of alternating runs of samples whose FORMAT/" +
+                                                                format.id +
+                                                                " value is kept or equal to the previous record's."};
+                hdr.infos.push_back(std::move(info));
+            }
+        }
+
+        if (!predictors.empty())
+        {
+            std::cerr << "Field " << predictors.begin()->first
+                      << " given to --predictor is not in the header. Exiting.\n";
+            std::exit(1);
+        }
+
+        // numeric INFO fields are handled like FORMAT fields
+        for (bio::var_io::header::info_t & info : hdr.infos)
+        {
+            // END is needed for indexing the encoded file
+            if (!options.compress_info || info.id.starts_with("DELTA_") || info.id == "END")
+                continue;
+
+            bool do_compress = false;
+            switch (info.type_id)
+            {
+                case bio::var_io::value_type_id::char8:
+                    do_compress = options.compress_chars;
+                    break;
+                case bio::var_io::value_type_id::float32:
+                case bio::var_io::value_type_id::vector_of_float32:
+                    do_compress = options.compress_floats;
+                    break;
+                case bio::var_io::value_type_id::flag:
+                case bio::var_io::value_type_id::string:
                 case bio::var_io::value_type_id::vector_of_string:
                     do_compress = false;
                     break;
@@ -200,58 +432,295 @@ void encode(encode_options_t const & options)
                     break;
             }
 
+            if (options.auto_tune)
+                do_compress = auto_result.delta_fields.contains("INFO/" + info.id);
+
             if (do_compress)
-                format.other_fields["Encoding"] = "Delta";
+                info.other_fields["Encoding"] = "Delta";
         }
     }
 
-    writer.set_header(hdr);
+    writer->set_header(hdr);
 
-    split_buffers_t split_buffers;
+    split_buffers_t     split_buffers;
+    format_plan_t const plan{hdr};
+    predictor_t         predictor{hdr};
 
     std::unique_ptr<bio::var_io::default_record<>> lrecord{new bio::var_io::default_record<>};
     std::unique_ptr<bio::var_io::default_record<>> brecord{new bio::var_io::default_record<>};
     lrecord->chrom() = "invalid";
     lrecord->pos()   = -1;
 
-    for (bio::var_io::default_record<> & record : reader)
+    std::optional<verifier_t> verifier;
+    if (options.delta_compress && options.verify)
+        verifier.emplace(hdr, std::max<size_t>(options.batch_size, options.read_ahead));
+
+    // with checksums, a record is held back until we know whether it ends a block
+    bool const                    checksum = options.delta_compress && options.checksum;
+    bio::var_io::default_record<> held_record;
+    bool                          has_held = false;
+    block_checksum_t              block_checksum;
+
+    /* verify and write the (encoded) record; original is the record before delta-compression */
+    auto emit = [&](bio::var_io::default_record<> &       record,
+                    bio::var_io::default_record<> const & original,
+                    bool const                            is_reference)
+    {
+        BCFDELTA_TRACE_SCOPE("write");
+
+        if (verifier)
+            verifier->push(record, original);
+
+        if (checksum)
+        {
+            if (has_held)
+            {
+                if (is_reference) // held record ends a block
+                    held_record.info().push_back({.id = "DELTA_SUM", .value = block_checksum.finish()});
+                writer->push_back(held_record);
+            }
+
+            block_checksum.add(original);
+            std::swap(held_record, record); // record now holds the last record which was written
+            has_held = true;
+        }
+        else
+        {
+            writer->push_back(record);
+        }
+    };
+
+    /* batch mode: records between references are gathered and transformed tile-by-tile over the samples */
+    bool const   batching      = options.delta_compress && options.batch_size > 0;
+    bool const   keep_original = verifier.has_value() || checksum;
+    size_t const n_samples     = hdr.column_labels.size() > 9 ? hdr.column_labels.size() - 9 : 0;
+
+    std::vector<bio::var_io::default_record<>>       batch;
+    std::vector<bio::var_io::default_record<>>       batch_original;
+    std::vector<size_t>                              batch_ref; // position of the reference record in batch or npos
+    std::vector<std::vector<format_plan_t::match_t>> batch_matches; // resolved once per batch, used by every tile
+    size_t                                           batch_n         = 0;
+    size_t                                           batch_biallelic = std::string::npos; // last bi-allelic in batch
+    size_t                                           batch_memory    = 0; // only tracked with a memory budget
+    size_t                                           batch_limit     = options.batch_size; // shrunk if over budget
+    size_t                                           memory_limit    = buffer_budget;      // shrunk if over budget
+
+    // the record before delta-compression if it is needed and not in bak_record (memory budget)
+    bio::var_io::default_record<> original_record;
+
+    auto flush = [&]()
+    {
+        if (batch_n == 0)
+            return;
+
+        // the last bi-allelic record in this batch is the "last record" for the next batch
+        if (batch_biallelic != std::string::npos)
+        {
+            if (bounded)
+                copy_reference_state(batch[batch_biallelic], *brecord, plan);
+            else
+                *brecord = batch[batch_biallelic];
+        }
+
+        BCFDELTA_TRACE_SCOPE("delta (batch)");
+
+        // INFO fields are not tiled
+        for (size_t k = batch_n; k-- > 0;)
+        {
+            if (batch_ref[k] != k)
+                do_info_delta(batch_ref[k] == std::string::npos ? *lrecord : batch[batch_ref[k]],
+                              batch[k],
+                              plan,
+                              options.skip_problematic);
+        }
+
+        for (size_t k = 0; k < batch_n; ++k)
+        {
+            if (batch_ref[k] != k)
+                batch_matches[k] =
+                  plan.resolve(batch_ref[k] == std::string::npos ? *lrecord : batch[batch_ref[k]], batch[k]);
+        }
+
+        for (size_t tile_begin = 0; tile_begin == 0 || tile_begin < n_samples; tile_begin += options.tile_size)
+        {
+            // in reverse order, so that the records referred to are still unchanged in this tile
+            for (size_t k = batch_n; k-- > 0;)
+            {
+                if (batch_ref[k] == k) // reference record
+                    continue;
+
+                bio::var_io::default_record<> const & last_record =
+                  batch_ref[k] == std::string::npos ? *lrecord : batch[batch_ref[k]];
+
+                do_format_delta(last_record,
+                                batch[k],
+                                plan,
+                                batch_matches[k],
+                                options.skip_problematic,
+                                tile_begin,
+                                tile_begin + options.tile_size);
+            }
+        }
+
+        for (size_t k = 0; k < batch_n; ++k)
+            emit(batch[k], keep_original ? batch_original[k] : batch[k], batch_ref[k] == k);
+
+        if (batch_biallelic != std::string::npos)
+            std::swap(lrecord, brecord);
+
+        batch_n         = 0;
+        batch_biallelic = std::string::npos;
+        batch_memory    = 0;
+    };
+
+    // the process is over the memory budget: write the batch, keep fewer records from now on and free the buffers
+    auto shrink_buffers = [&]()
+    {
+        flush();
+
+        batch_limit  = std::max<size_t>(batch_limit / 2, 1);
+        memory_limit = memory_limit / 2;
+        batch.resize(std::min(batch.size(), batch_limit));
+        batch.shrink_to_fit();
+        batch_original.resize(batch.size());
+        batch_original.shrink_to_fit();
+        batch_ref.resize(batch.size());
+        batch_matches.resize(batch.size());
+
+        if (verifier)
+            verifier->shrink_queue();
+    };
+
+    auto process = [&](bio::var_io::default_record<> & record)
     {
         bio::var_io::default_record<> & last_record = *lrecord;
         bio::var_io::default_record<> & bak_record  = *brecord;
 
+        if (governor.over_budget())
+            shrink_buffers();
+
         /* split fields */
-        if (options.split_fields)
+        if (split_fields)
+        {
+            BCFDELTA_TRACE_SCOPE("split");
             do_split(record, split_buffers);
+        }
 
-        /* delta compression */
-        if (options.delta_compress)
+        if (batching)
         {
-            // backup the record as it is changed in-place
-            bak_record = record;
+            bool const is_reference = starts_new_block(
+              batch_biallelic == std::string::npos ? last_record : batch[batch_biallelic], record, options.ref_freq);
 
-            // this is a "reference record"
-            if ((record.alt().size() == 1) && // multi-allelic can never be reference
-                  (last_record.chrom() != record.chrom()) ||
-                (last_record.pos() / options.ref_freq != record.pos() / options.ref_freq))
+            if (is_reference)
+                flush();
+
+            if (batch_n == batch.size())
             {
-                record.info().push_back({.id = "DELTA_REF", .value = true});
+                batch.emplace_back();
+                batch_original.emplace_back();
+                batch_ref.emplace_back();
+                batch_matches.emplace_back();
             }
-            else // this will be delta-compressed
+
+            std::swap(batch[batch_n], record); // record gets the buffers of an emitted record
+            if (keep_original)
+                batch_original[batch_n] = batch[batch_n];
+
+            // predictors only depend on the previous records, so they are applied in order
+            predictor.encode(batch[batch_n], is_reference);
+
+            batch[batch_n].info().push_back({.id = is_reference ? "DELTA_REF" : "DELTA_COMP", .value = true});
+            batch_ref[batch_n] = is_reference ? batch_n : batch_biallelic;
+
+            if (batch[batch_n].alt().size() == 1)
+                batch_biallelic = batch_n;
+
+            if (bounded)
+                batch_memory += record_memory(batch[batch_n]) * (keep_original ? 2 : 1);
+
+            ++batch_n;
+
+            if (batch_n >= batch_limit || (bounded && batch_memory > memory_limit))
+                flush();
+        }
+        else
+        {
+            bool is_reference = true;
+
+            /* delta compression */
+            if (options.delta_compress)
             {
-                record.info().push_back({.id = "DELTA_COMP", .value = true});
-                do_delta(last_record, record, hdr, options.skip_problematic);
+                // backup the record as it is changed in-place; with a memory budget only what is needed later
+                if (!bounded)
+                {
+                    bak_record = record;
+                }
+                else
+                {
+                    if (record.alt().size() == 1)
+                        copy_reference_state(record, bak_record, plan);
+                    if (keep_original)
+                        original_record = record;
+                }
+
+                // this is a "reference record"
+                if (starts_new_block(last_record, record, options.ref_freq))
+                {
+                    record.info().push_back({.id = "DELTA_REF", .value = true});
+                }
+                else // this will be delta-compressed
+                {
+                    BCFDELTA_TRACE_SCOPE("delta");
+                    is_reference = false;
+                    record.info().push_back({.id = "DELTA_COMP", .value = true});
+                    do_delta(last_record, record, plan, options.skip_problematic);
+                }
+
+                predictor.encode(record, is_reference);
             }
-        }
 
-        /* write the record */
-        writer.push_back(record);
+            bool const is_biallelic = record.alt().size() == 1;
+
+            /* write the record */
+            emit(record, bounded ? original_record : bak_record, is_reference);
+
+            /* make the backup of the current record the "last record" */
+            if (options.delta_compress && is_biallelic)
+                std::swap(lrecord, brecord);
+        }
 
         /* get back some buffers */
-        if (options.split_fields)
+        if (split_fields)
             salvage_split_buffers(record, split_buffers);
+    };
 
-        /* make the backup of the current record the "last record" */
-        if (options.delta_compress && record.alt().size() == 1)
-            std::swap(lrecord, brecord);
+    for (bio::var_io::default_record<> & record : sample)
+        process(record);
+
+    while (it != reader.end())
+    {
+        process(*it);
+
+        BCFDELTA_TRACE_SCOPE("read");
+        ++it;
+    }
+
+    flush();
+
+    if (has_held)
+    {
+        held_record.info().push_back({.id = "DELTA_SUM", .value = block_checksum.finish()});
+        writer->push_back(held_record);
     }
+
+    if (verifier)
+        verifier->finish();
+
+    writer.reset();
+    finish_output(output_stream);
+
+    finish_tracing(options.trace);
+
+    if (bounded)
+        report_memory(options.max_memory);
 }
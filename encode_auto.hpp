@@ -0,0 +1,203 @@
+#pragma once
+
+#include <map>
+#include <set>
+
+#include <zlib.h>
+
+#include <bio/var_io/reader.hpp>
+
+#include "encode_delta.hpp"
+#include "encode_split.hpp"
+#include "shared.hpp"
+
+struct auto_tune_result_t
+{
+    bool                  split_fields = false;
+    std::set<std::string> delta_fields;
+};
+
+// number of bytes after deflating; this approximates the size inside of the BGZF blocks
+size_t deflated_size(std::string const & bytes)
+{
+    uLongf             out_size = compressBound(bytes.size());
+    std::vector<Bytef> out(out_size);
+
+    if (compress2(out.data(),
+                  &out_size,
+                  reinterpret_cast<Bytef const *>(bytes.data()),
+                  bytes.size(),
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        throw delta_error{"Could not deflate sample data."};
+    }
+
+    return out_size;
+}
+
+// append the raw bytes of a (nested) range of numbers, characters or strings
+template <typename rng_t>
+void append_raw_bytes_rng(rng_t const & rng, std::string & out)
+{
+    using alph_t         = seqan3::range_innermost_value_t<rng_t>;
+    constexpr size_t dim = seqan3::range_dimension_v<rng_t>;
+
+    if constexpr (dim == 1 && std::is_arithmetic_v<alph_t> && !std::same_as<alph_t, bool>)
+    {
+        out.append(reinterpret_cast<char const *>(rng.data()), rng.size() * sizeof(alph_t));
+    }
+    else if constexpr (dim == 2 && std::is_arithmetic_v<alph_t> && !std::same_as<alph_t, char>)
+    {
+        std::span concat = rng.concat();
+        out.append(reinterpret_cast<char const *>(concat.data()), concat.size() * sizeof(alph_t));
+    }
+    else if constexpr (dim >= 2 && std::same_as<alph_t, char>) // one or more strings per sample
+    {
+        for (auto && elem : rng)
+        {
+            append_raw_bytes_rng(elem, out);
+            out.push_back('\0');
+        }
+    }
+}
+
+// append the raw bytes of all values of an INFO or FORMAT field; flags are ignored
+void append_raw_bytes(auto const & field_value, std::string & out)
+{
+    auto fun = [&]<typename rng_t>(rng_t const & rng)
+    {
+        if constexpr (std::is_arithmetic_v<rng_t>)
+        {
+            if constexpr (!std::same_as<rng_t, bool>)
+                out.append(reinterpret_cast<char const *>(&rng), sizeof(rng_t));
+        }
+        else
+        {
+            append_raw_bytes_rng(rng, out);
+        }
+    };
+
+    std::visit(fun, field_value);
+}
+
+// the field that an INFO field's bytes count towards; the replaced samples of a STRING field count towards it
+std::string trial_field_name(std::string const & info_id)
+{
+    if (info_id.starts_with("DELTA_SAME_"))
+        return "FORMAT/" + info_id.substr(std::string_view{"DELTA_SAME_"}.size());
+    else
+        return "INFO/" + info_id;
+}
+
+/* Trial-encode the sample and return the deflated size of every field without and with delta-compression.
+ * The sample is not changed; every record is copied into the same scratch record, whose buffers are reused.
+ */
+std::map<std::string, std::pair<size_t, size_t>> trial_encode(
+  std::vector<bio::var_io::default_record<>> const & sample,
+  bio::var_io::header const &                        hdr,
+  bool const                                         split_fields,
+  uint64_t const                                     ref_freq,
+  bool const                                         skip_problematic)
+{
+    std::map<std::string, std::pair<std::string, std::string>> bytes;
+    split_buffers_t                                              split_buffers;
+
+    format_plan_t const           plan{hdr};
+    bio::var_io::default_record<> record;
+    bio::var_io::default_record<> last_record;
+    bio::var_io::default_record<> bak_record;
+    last_record.chrom() = "invalid";
+    last_record.pos()   = -1;
+
+    for (bio::var_io::default_record<> const & original : sample)
+    {
+        record = original;
+
+        if (split_fields)
+            do_split(record, split_buffers);
+
+        for (auto const & info : record.info())
+            append_raw_bytes(info.value, bytes["INFO/" + info.id].first);
+        for (auto const & genotype : record.genotypes())
+            append_raw_bytes(genotype.value, bytes["FORMAT/" + genotype.id].first);
+
+        bool const is_reference = starts_new_block(last_record, record, ref_freq);
+
+        if (!is_reference)
+        {
+            bak_record = record;
+            do_delta(last_record, record, plan, skip_problematic);
+        }
+
+        for (auto const & info : record.info())
+            append_raw_bytes(info.value, bytes[trial_field_name(info.id)].second);
+        for (auto const & genotype : record.genotypes())
+            append_raw_bytes(genotype.value, bytes["FORMAT/" + genotype.id].second);
+
+        if (record.alt().size() == 1)
+            std::swap(last_record, is_reference ? record : bak_record);
+
+        if (split_fields)
+            salvage_split_buffers(record, split_buffers);
+    }
+
+    std::map<std::string, std::pair<size_t, size_t>> ret;
+    for (auto const & [id, plain_and_delta] : bytes)
+        ret[id] = {deflated_size(plain_and_delta.first), deflated_size(plain_and_delta.second)};
+
+    return ret;
+}
+
+/* Decide on splitting and on the fields that are delta-compressed by trial-encoding a sample of records.
+ * Every field that could be compressed gets "Encoding=Delta" in the trial header; a field is compressed
+ * in the actual run only if that makes its deflated data smaller.
+ * Fields are identified as "INFO/ID" and "FORMAT/ID".
+ */
+auto_tune_result_t auto_tune(std::vector<bio::var_io::default_record<>> const & sample,
+                             bio::var_io::header const &                        in_hdr,
+                             uint64_t const                                     ref_freq,
+                             bool const                                         skip_problematic)
+{
+    auto run_trial = [&](bool const split_fields)
+    {
+        bio::var_io::header hdr = in_hdr;
+        if (split_fields)
+            add_split_formats(hdr);
+
+        for (bio::var_io::header::format_t & format : hdr.formats)
+            format.other_fields["Encoding"] = "Delta";
+
+        for (bio::var_io::header::info_t & info : hdr.infos)
+            if (info.type_id != bio::var_io::value_type_id::flag &&
+                info.type_id != bio::var_io::value_type_id::string &&
+                info.type_id != bio::var_io::value_type_id::vector_of_string && info.id != "END")
+                info.other_fields["Encoding"] = "Delta";
+
+        return trial_encode(sample, hdr, split_fields, ref_freq, skip_problematic);
+    };
+
+    auto total_size = [](auto const & sizes)
+    {
+        size_t ret = 0;
+        for (auto const & [id, plain_and_delta] : sizes)
+            ret += std::min(plain_and_delta.first, plain_and_delta.second);
+        return ret;
+    };
+
+    auto_tune_result_t ret{};
+
+    std::map<std::string, std::pair<size_t, size_t>> sizes       = run_trial(false);
+    std::map<std::string, std::pair<size_t, size_t>> split_sizes = run_trial(true);
+
+    if (total_size(split_sizes) < total_size(sizes))
+    {
+        ret.split_fields = true;
+        sizes            = std::move(split_sizes);
+    }
+
+    for (auto const & [id, plain_and_delta] : sizes)
+        if (plain_and_delta.second < plain_and_delta.first)
+            ret.delta_fields.insert(id);
+
+    return ret;
+}
@@ -2,40 +2,104 @@
 
 #include <bio/var_io/reader.hpp>
 
+#include "kernels.hpp"
 #include "shared.hpp"
+#include "trace.hpp"
 
-void do_delta(bio::var_io::default_record<> const & last_record,
-              bio::var_io::default_record<> &       record,
-              bio::var_io::header const &           hdr,
-              bool const                            skip_problematic)
+// whether the record is stored as-is ("reference record") instead of being delta-compressed
+bool starts_new_block(bio::var_io::default_record<> const & last_record,
+                      bio::var_io::default_record<> const & record,
+                      uint64_t const                        ref_freq)
+{
+    return (record.alt().size() == 1) && // multi-allelic can never be reference
+           ((last_record.chrom() != record.chrom()) ||
+            (last_record.pos() / ref_freq != record.pos() / ref_freq));
+}
+
+// delta-compress the FORMAT fields found by format_plan_t::resolve() for the given range of samples
+void do_format_delta(bio::var_io::default_record<> const &       last_record,
+                     bio::var_io::default_record<> &             record,
+                     format_plan_t const &                       plan,
+                     std::vector<format_plan_t::match_t> const & matches,
+                     bool const                                  skip_problematic,
+                     size_t const                                sample_begin = 0,
+                     size_t const                                sample_end   = std::numeric_limits<size_t>::max())
 {
-    for (auto it = record.genotypes().begin(); it != record.genotypes().end(); ++it)
+    for (format_plan_t::match_t const & match : matches)
     {
-        bio::var_io::header::format_t const & format = hdr.formats[hdr.string_to_format_pos().at(it->id)];
+        auto const & last = last_record.genotypes()[match.last_pos];
+        auto &       cur  = record.genotypes()[match.cur_pos];
+
+        BCFDELTA_TRACE_SCOPE(match.field->name.c_str());
+
+        // residuals are computed in int32_t, also by the decoder; the writer narrows them again
+        widen_to_int32(cur.value);
+
+        std::vector<int32_t>         same_runs; // only filled for STRING fields
+        std::vector<int32_t> * const same_runs_ptr = match.field->is_string ? &same_runs : nullptr;
+
+        if (skip_problematic)
+        {
+            plan.run<std::minus<>, true>(*match.field,
+                                         cur.id,
+                                         record.alt().size(),
+                                         last.value,
+                                         cur.value,
+                                         sample_begin,
+                                         sample_end,
+                                         same_runs_ptr);
+        }
+        else
+        {
+            plan.run<std::minus<>, false>(*match.field,
+                                          cur.id,
+                                          record.alt().size(),
+                                          last.value,
+                                          cur.value,
+                                          sample_begin,
+                                          sample_end,
+                                          same_runs_ptr);
+        }
+
+        if (!same_runs.empty())
+            record.info().push_back({.id = match.field->same_id, .value = std::move(same_runs)});
+    }
+}
+
+void do_format_delta(bio::var_io::default_record<> const & last_record,
+                     bio::var_io::default_record<> &       record,
+                     format_plan_t const &                 plan,
+                     bool const                            skip_problematic)
+{
+    do_format_delta(last_record, record, plan, plan.resolve(last_record, record), skip_problematic);
+}
 
-        if (!format.other_fields.contains("Encoding") || format.other_fields.at("Encoding") != "Delta")
+void do_info_delta(bio::var_io::default_record<> const & last_record,
+                   bio::var_io::default_record<> &       record,
+                   format_plan_t const &                 plan,
+                   bool const                            skip_problematic)
+{
+    for (auto it = record.info().begin(); it != record.info().end(); ++it)
+    {
+        int32_t const * number = plan.find_info(it->id);
+        if (number == nullptr)
             continue;
 
-        for (auto lit = last_record.genotypes().begin(); lit != last_record.genotypes().end(); ++lit)
+        for (auto lit = last_record.info().begin(); lit != last_record.info().end(); ++lit)
         {
             if (it->id == lit->id)
             {
-                if (!bio::detail::type_id_is_compatible(bio::var_io::value_type_id{it->value.index()},
-                                                        bio::var_io::value_type_id{lit->value.index()}))
-                {
-                    throw delta_error{"The type of this record's ",
-                                      it->id,
-                                      " field did is not compatible with the previous record."};
-                }
+                // residuals are computed in int32_t, also by the decoder; the writer narrows them again
+                widen_to_int32(it->value);
 
                 if (skip_problematic)
                 {
-                    delta_visitor<std::minus<>, true> visitor{it->id, format.number, record.alt().size(), &hdr};
+                    info_delta_visitor<std::minus<>, true> visitor{it->id, *number, record.alt().size()};
                     std::visit(visitor, lit->value, it->value);
                 }
                 else
                 {
-                    delta_visitor<std::minus<>, false> visitor{it->id, format.number, record.alt().size(), &hdr};
+                    info_delta_visitor<std::minus<>, false> visitor{it->id, *number, record.alt().size()};
                     std::visit(visitor, lit->value, it->value);
                 }
 
@@ -44,3 +108,12 @@ void do_delta(bio::var_io::default_record<> const & last_record,
         }
     }
 }
+
+void do_delta(bio::var_io::default_record<> const & last_record,
+              bio::var_io::default_record<> &       record,
+              format_plan_t const &                 plan,
+              bool const                            skip_problematic)
+{
+    do_info_delta(last_record, record, plan, skip_problematic);
+    do_format_delta(last_record, record, plan, skip_problematic);
+}
@@ -13,6 +13,41 @@ struct split_buffers_t
     seqan3::concatenated_sequences<std::vector<int32_t>> pl3;
 };
 
+void add_split_formats(bio::var_io::header & hdr)
+{
+    // rename AD to AD_ALT
+    hdr.formats.push_back({.id          = "AD_ALT",
+                           .number      = bio::var_io::header_number::A,
+                           .type        = "Integer",
+                           .type_id     = bio::var_io::value_type_id::vector_of_int32,
+                           .description = "ALT entries of AD field."});
+
+    // add ad_ref
+    hdr.formats.push_back({.id          = "AD_REF",
+                           .number      = 1,
+                           .type        = "Integer",
+                           .type_id     = bio::var_io::value_type_id::int32,
+                           .description = "REF entry of AD field."});
+
+    hdr.formats.push_back({.id          = "PL1",
+                           .number      = 1,
+                           .type        = "Integer",
+                           .type_id     = bio::var_io::value_type_id::int32,
+                           .description = "PL values for 00."});
+
+    hdr.formats.push_back({.id          = "PL2",
+                           .number      = bio::var_io::header_number::A,
+                           .type        = "Integer",
+                           .type_id     = bio::var_io::value_type_id::vector_of_int32,
+                           .description = "PL values for ab where a == 0 and b >= 1."});
+
+    hdr.formats.push_back({.id          = "PL3",
+                           .number      = bio::var_io::header_number::dot,
+                           .type        = "Integer",
+                           .type_id     = bio::var_io::value_type_id::vector_of_int32,
+                           .description = "PL values for ab where a >= 1 and b >= 1"});
+}
+
 void do_split(bio::var_io::default_record<> & record, split_buffers_t & split_buffers)
 {
     using genotype_t = bio::var_io::genotype_element<bio::ownership::deep>;
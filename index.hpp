@@ -0,0 +1,496 @@
+#pragma once
+
+/* Building CSI (for BCF) and TBI (for VCF.gz) indexes while writing, instead of reading the output again afterwards.
+ * The indexer parses the uncompressed records as they are handed to the BGZF compression, so it does not depend on
+ * how the writer buffers its output. Offsets are kept as offsets into the uncompressed data and are turned into
+ * virtual offsets once the BGZF stream is finished. The binning scheme and the file layouts follow the SAM/VCF
+ * index specifications (and htslib).
+ */
+
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+#include "bgzf.hpp"
+#include "shared.hpp"
+
+static_assert(std::endian::native == std::endian::little, "Index files are written in the native byte order.");
+
+enum class index_format_t
+{
+    csi, // for BCF
+    tbi  // for VCF.gz
+};
+
+class record_indexer_t
+{
+public:
+    static constexpr int32_t min_shift = 14;
+
+    explicit record_indexer_t(index_format_t const format) : format{format} {}
+
+    // parse the uncompressed VCF or BCF data
+    void consume(std::span<char const> data)
+    {
+        while (!data.empty())
+        {
+            size_t const n = format == index_format_t::csi ? consume_bcf(data) : consume_vcf(data);
+            data           = data.subspan(n);
+        }
+    }
+
+    // write the index; the data must have been written completely to the stream
+    void write(std::filesystem::path const & path, bgzf_ostream const & data_stream) const
+    {
+        std::unique_ptr<std::ofstream> file{new std::ofstream{path, std::ios::binary}};
+        if (!*file)
+            throw delta_error{"Could not open ", path, " for writing the index."};
+
+        bgzf_ostream out{std::move(file), 1, Z_DEFAULT_COMPRESSION};
+
+        auto put = [&]<typename value_t>(value_t const value)
+        { out.write(reinterpret_cast<char const *>(&value), sizeof(value)); };
+
+        size_t n_ref = refs.size();
+        if (format == index_format_t::csi)
+        {
+            n_ref = std::max<size_t>(n_ref, n_contigs);
+
+            out.write("CSI\1", 4);
+            put(int32_t{min_shift});
+            put(int32_t{n_lvls});
+            put(int32_t{0}); // no auxiliary data
+            put(static_cast<int32_t>(n_ref));
+        }
+        else
+        {
+            out.write("TBI\1", 4);
+            put(static_cast<int32_t>(n_ref));
+            put(int32_t{2});   // VCF
+            put(int32_t{1});   // column of CHROM
+            put(int32_t{2});   // column of POS
+            put(int32_t{0});   // no end column
+            put(int32_t{'#'}); // header lines
+            put(int32_t{0});   // lines to skip
+
+            int32_t l_nm = 0;
+            for (std::string const & name : names)
+                l_nm += name.size() + 1;
+            put(l_nm);
+            for (std::string const & name : names)
+                out.write(name.c_str(), name.size() + 1);
+        }
+
+        for (size_t tid = 0; tid < n_ref; ++tid)
+        {
+            if (tid >= refs.size() || refs[tid].n_records == 0)
+            {
+                put(int32_t{0}); // no bins
+                if (format == index_format_t::tbi)
+                    put(int32_t{0}); // no intervals
+                continue;
+            }
+
+            ref_t const & ref = refs[tid];
+
+            // linear index: windows before the first record and without records start at the previous record
+            std::vector<uint64_t> linear = ref.linear;
+            for (size_t w = 0; w < linear.size(); ++w)
+            {
+                if (linear[w] == unset)
+                    linear[w] = w == 0 ? ref.begin : linear[w - 1];
+                linear[w] = data_stream.virtual_offset(linear[w]);
+            }
+
+            put(static_cast<int32_t>(ref.bins.size() + 1)); // plus meta-bin
+
+            for (auto const & [bin, chunks] : ref.bins)
+            {
+                // chunks that end and start in the same BGZF block are merged
+                std::vector<chunk_t> merged;
+                for (chunk_t const & chunk : chunks)
+                {
+                    chunk_t const vchunk{data_stream.virtual_offset(chunk.begin),
+                                         data_stream.virtual_offset(chunk.end)};
+                    if (!merged.empty() && merged.back().end >> 16 == vchunk.begin >> 16)
+                        merged.back().end = std::max(merged.back().end, vchunk.end);
+                    else
+                        merged.push_back(vchunk);
+                }
+
+                put(bin);
+                if (format == index_format_t::csi)
+                {
+                    size_t const bot = bin_bottom(bin);
+                    put(uint64_t{bot < linear.size() ? linear[bot] : 0});
+                }
+                put(static_cast<int32_t>(merged.size()));
+                for (chunk_t const & chunk : merged)
+                {
+                    put(chunk.begin);
+                    put(chunk.end);
+                }
+            }
+
+            // meta-bin: the offsets of the reference and its number of records
+            put(static_cast<uint32_t>(bin_first(n_lvls + 1) + 1));
+            if (format == index_format_t::csi)
+                put(uint64_t{0});
+            put(int32_t{2});
+            put(data_stream.virtual_offset(ref.begin));
+            put(data_stream.virtual_offset(ref.end));
+            put(ref.n_records);
+            put(uint64_t{0});
+
+            if (format == index_format_t::tbi)
+            {
+                put(static_cast<int32_t>(linear.size()));
+                for (uint64_t const offset : linear)
+                    put(offset);
+            }
+        }
+
+        put(uint64_t{0}); // no records without coordinates
+
+        out.finish();
+    }
+
+private:
+    static constexpr uint64_t unset = std::numeric_limits<uint64_t>::max();
+
+    // offsets in the uncompressed data
+    struct chunk_t
+    {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct ref_t
+    {
+        std::map<uint32_t, std::vector<chunk_t>> bins;
+        std::vector<uint64_t>                    linear; // first record overlapping each 16 kbp window
+        uint64_t                                 begin     = unset;
+        uint64_t                                 end       = 0;
+        uint64_t                                 n_records = 0;
+    };
+
+    index_format_t const format;
+    int32_t              n_lvls = 5; // TBI always has 5 levels, CSI as many as the longest contig needs
+
+    std::vector<ref_t>       refs;
+    std::vector<std::string> names;         // TBI only; in the order of the records
+    size_t                   n_contigs = 0; // CSI only; in the header
+
+    int64_t last_tid = -1;
+    int64_t last_beg = -1;
+
+    // parser state
+    uint64_t    offset     = 0; // of the next byte in the uncompressed data
+    std::string buffer;         // BCF: fixed-size parts; VCF: the columns up to INFO
+    std::string header_text;
+    int         state      = 0; // BCF: 0 = magic, 1 = header text, 2 = record; VCF: 1 = after INFO
+    uint64_t    skip       = 0; // BCF: bytes that are not needed
+    uint32_t    l_text     = 0; // BCF: length of the header text
+    uint64_t    line_begin = 0; // VCF: offset of the current line
+    size_t      n_tabs     = 0; // VCF: in the current line
+
+    static constexpr int64_t bin_first(int32_t const level) { return ((int64_t{1} << (3 * level)) - 1) / 7; }
+
+    // the bin of the region [beg, end)
+    uint32_t reg2bin(int64_t const beg, int64_t end) const
+    {
+        --end;
+        int32_t s = min_shift;
+        for (int32_t l = n_lvls; l > 0; --l, s += 3)
+            if (beg >> s == end >> s)
+                return bin_first(l) + (beg >> s);
+        return 0;
+    }
+
+    // the first linear index window of the bin
+    size_t bin_bottom(uint32_t const bin) const
+    {
+        int32_t level = 0;
+        for (int64_t b = bin; b > 0; b = (b - 1) >> 3)
+            ++level;
+        return (bin - bin_first(level)) << (3 * (n_lvls - level));
+    }
+
+    void push(int64_t const tid, int64_t const beg, int64_t end, uint64_t const record_begin, uint64_t const record_end)
+    {
+        end = std::max(end, beg + 1);
+
+        if (tid < 0 || beg < 0)
+            throw delta_error{"Records without a valid CHROM or POS cannot be indexed."};
+        if (tid < last_tid || (tid == last_tid && beg < last_beg))
+            throw delta_error{"The output is not sorted by position, so it cannot be indexed."};
+        if (end > int64_t{1} << (min_shift + 3 * n_lvls))
+            throw delta_error{"Position ", end, " is too large for the index format."};
+
+        last_tid = tid;
+        last_beg = beg;
+
+        if (refs.size() <= static_cast<size_t>(tid))
+            refs.resize(tid + 1);
+        ref_t & ref = refs[tid];
+
+        std::vector<chunk_t> & chunks = ref.bins[reg2bin(beg, end)];
+        if (!chunks.empty() && chunks.back().end == record_begin) // the previous record was in the same bin
+            chunks.back().end = record_end;
+        else
+            chunks.push_back({record_begin, record_end});
+
+        size_t const first_window = beg >> min_shift;
+        size_t const last_window  = (end - 1) >> min_shift;
+        if (ref.linear.size() <= last_window)
+            ref.linear.resize(last_window + 1, unset);
+        for (size_t w = first_window; w <= last_window; ++w)
+            if (ref.linear[w] == unset)
+                ref.linear[w] = record_begin;
+
+        ref.begin = std::min(ref.begin, record_begin);
+        ref.end   = record_end;
+        ++ref.n_records;
+    }
+
+    // count the contigs in the header and choose the number of levels for the longest one (like htslib)
+    void parse_contigs()
+    {
+        int64_t max_len = 0;
+        for (size_t pos = header_text.find("##contig=<"); pos != std::string::npos;
+             pos        = header_text.find("##contig=<", pos + 1))
+        {
+            ++n_contigs;
+
+            size_t const line_end = header_text.find('\n', pos);
+            size_t const len_pos  = header_text.find("length=", pos);
+            if (len_pos != std::string::npos && len_pos < line_end)
+            {
+                int64_t len = 0;
+                std::from_chars(header_text.data() + len_pos + 7, header_text.data() + header_text.size(), len);
+                max_len = std::max(max_len, len);
+            }
+        }
+
+        if (max_len == 0)
+            max_len = (int64_t{1} << 31) - 1;
+        max_len += 256;
+
+        n_lvls = 0;
+        for (int64_t s = int64_t{1} << min_shift; max_len > s; s <<= 3)
+            ++n_lvls;
+    }
+
+    // consume bytes of BCF data; returns the number of bytes consumed
+    size_t consume_bcf(std::span<char const> const data)
+    {
+        if (skip > 0)
+        {
+            size_t const n = std::min<uint64_t>(skip, data.size());
+            skip -= n;
+            offset += n;
+            return n;
+        }
+
+        size_t const need = state == 0 ? 9 : state == 1 ? l_text : 20;
+        size_t const n    = std::min(need - buffer.size(), data.size());
+        buffer.append(data.data(), n);
+        offset += n;
+
+        if (buffer.size() < need)
+            return n;
+
+        auto get = [&]<typename value_t>(value_t & value, size_t const pos)
+        { std::memcpy(&value, buffer.data() + pos, sizeof(value)); };
+
+        if (state == 0) // "BCF\2\2" and the length of the header text
+        {
+            if (buffer.compare(0, 3, "BCF") != 0)
+                throw delta_error{"The output is not BCF, so it cannot be indexed as such."};
+            get(l_text, 5);
+            state = l_text > 0 ? 1 : 2;
+        }
+        else if (state == 1)
+        {
+            header_text = std::move(buffer);
+            parse_contigs();
+            state = 2;
+        }
+        else // l_shared, l_indiv, CHROM, POS (0-based), rlen
+        {
+            uint32_t l_shared = 0;
+            uint32_t l_indiv  = 0;
+            int32_t  tid      = 0;
+            int32_t  pos      = 0;
+            int32_t  rlen     = 0;
+            get(l_shared, 0);
+            get(l_indiv, 4);
+            get(tid, 8);
+            get(pos, 12);
+            get(rlen, 16);
+
+            if (l_shared < 12)
+                throw delta_error{"Malformed BCF record, cannot index the output."};
+
+            uint64_t const record_begin = offset - 20;
+            uint64_t const record_end   = record_begin + 8 + l_shared + l_indiv;
+            push(tid, pos, int64_t{pos} + rlen, record_begin, record_end);
+
+            skip = record_end - offset;
+        }
+
+        buffer.clear();
+        return n;
+    }
+
+    // index the record in buffer (the columns up to INFO); the record ends at the current offset
+    void index_vcf_line(uint64_t const record_begin)
+    {
+        std::string_view columns[8];
+        size_t           n_columns = 0;
+        for (size_t begin = 0; n_columns < 8 && begin <= buffer.size();)
+        {
+            size_t const end     = std::min(buffer.find('\t', begin), buffer.size());
+            columns[n_columns++] = std::string_view{buffer}.substr(begin, end - begin);
+            begin                = end + 1;
+        }
+
+        if (n_columns < 4)
+            throw delta_error{"Malformed VCF record, cannot index the output."};
+
+        if (names.empty() || names.back() != columns[0])
+        {
+            if (std::ranges::find(names, columns[0]) != names.end())
+                throw delta_error{"The output is not sorted by position, so it cannot be indexed."};
+            names.emplace_back(columns[0]);
+        }
+
+        int64_t pos = 0;
+        std::from_chars(columns[1].data(), columns[1].data() + columns[1].size(), pos);
+        int64_t const beg = pos - 1;
+        int64_t       end = beg + columns[3].size();
+
+        // END in INFO, which is 1-based and inclusive
+        if (n_columns == 8)
+        {
+            std::string_view const info = columns[7];
+            for (size_t p = info.find("END="); p != std::string_view::npos; p = info.find("END=", p + 1))
+            {
+                if (p == 0 || info[p - 1] == ';')
+                {
+                    int64_t info_end = 0;
+                    std::from_chars(info.data() + p + 4, info.data() + info.size(), info_end);
+                    if (info_end > beg)
+                        end = info_end;
+                    break;
+                }
+            }
+        }
+
+        push(names.size() - 1, beg, end, record_begin, offset);
+    }
+
+    // the current line has ended (the newline is consumed)
+    void end_vcf_line()
+    {
+        if (!buffer.empty() && buffer[0] == '#')
+            header_text.append(buffer).push_back('\n');
+        else if (!buffer.empty())
+            index_vcf_line(line_begin);
+
+        buffer.clear();
+        line_begin = offset;
+        n_tabs     = 0;
+        state      = 0;
+    }
+
+    // consume bytes of VCF data; returns the number of bytes consumed
+    size_t consume_vcf(std::span<char const> const data)
+    {
+        if (state == 1) // the columns after INFO are not needed
+        {
+            void const * newline = std::memchr(data.data(), '\n', data.size());
+            size_t const n = newline == nullptr ? data.size() : static_cast<char const *>(newline) - data.data() + 1;
+            offset += n;
+            if (newline != nullptr)
+                end_vcf_line();
+            return n;
+        }
+
+        size_t n = 0;
+        while (n < data.size())
+        {
+            char const c = data[n++];
+            ++offset;
+
+            if (c == '\n')
+            {
+                end_vcf_line();
+                return n;
+            }
+
+            buffer.push_back(c);
+            if (c == '\t' && buffer[0] != '#' && ++n_tabs == 8)
+            {
+                buffer.pop_back();
+                state = 1;
+                break;
+            }
+        }
+
+        return n;
+    }
+};
+
+// a BGZF stream that indexes the records written to it; finish() writes the remaining data and the index
+class indexed_ostream : public bgzf_ostream
+{
+public:
+    indexed_ostream(std::unique_ptr<std::ostream> out,
+                    std::filesystem::path         index_path,
+                    index_format_t const          format,
+                    size_t const                  threads,
+                    int const                     level) :
+      bgzf_ostream{std::move(out), threads, level}, index_path{std::move(index_path)}, indexer{format}
+    {
+        set_observer([this](std::span<char const> const data) { indexer.consume(data); });
+    }
+
+    // without finish(), writing failed and no index is written (the indexer is destroyed before the base class)
+    ~indexed_ostream() { set_observer({}); }
+
+    /* Finish the BGZF stream and write the index; the writer may still write (the header) when it is destroyed, so
+     * this has to be called afterwards. The index is written to a temporary file that replaces the index only when it
+     * is complete. Throws delta_error.
+     */
+    void finish()
+    {
+        bgzf_ostream::finish();
+
+        std::filesystem::path tmp_path = index_path;
+        tmp_path += ".tmp";
+
+        try
+        {
+            indexer.write(tmp_path, *this);
+        }
+        catch (...)
+        {
+            std::error_code ec;
+            std::filesystem::remove(tmp_path, ec);
+            throw;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, index_path, ec);
+        if (ec)
+            throw delta_error{"Could not write the index ", index_path, ": ", ec.message()};
+    }
+
+private:
+    std::filesystem::path index_path;
+    record_indexer_t      indexer;
+};
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <seqan3/argument_parser/all.hpp>
+
+#include <bio/stream/transparent_istream.hpp>
+#include <bio/var_io/reader.hpp>
+#include <bio/var_io/writer.hpp>
+
+#include "index.hpp"
+#include "shared.hpp"
+#include "uring.hpp"
+
+// like seqan3::input_file_validator, but also accepts "-" for stdin
+struct input_path_validator
+{
+    using option_value_type = std::filesystem::path;
+
+    seqan3::input_file_validator<> file_validator{
+      {"vcf", "vcf.gz", "bcf"}
+    };
+
+    void operator()(option_value_type const & path) const
+    {
+        if (path != "-")
+            file_validator(path);
+    }
+
+    std::string get_help_page_message() const
+    {
+        return file_validator.get_help_page_message() + " Use \"-\" to read from stdin.";
+    }
+};
+
+/* Output types follow bcftools' -O:
+ * v: uncompressed VCF, z: compressed VCF, b: compressed BCF, u: uncompressed BCF
+ * An empty output type means that the type is deduced from the file extension.
+ */
+void add_output_type_option(seqan3::argument_parser & parser, std::string & output_type)
+{
+    parser.add_option(output_type,
+                      'O',
+                      "output-type",
+                      "v: VCF, z: compressed VCF, b: compressed BCF, u: uncompressed BCF. Deduced from the file "
+                      "extension by default; \"b\" if writing to stdout.");
+}
+
+/* Compression profiles for BGZF output (z and b), trading speed for size:
+ * fast: level 1, balanced: the default level of the library, archive: level 9.
+ * An explicit level takes precedence; level 0 writes BGZF blocks without compression.
+ * With fast (or if bcfdelta was built with libdeflate), bcfdelta deflates output files itself (see make_writer()).
+ */
+void add_compression_options(seqan3::argument_parser & parser, int & level, std::string & profile)
+{
+    parser.add_option(profile,
+                      '\0',
+                      "profile",
+                      "Compression profile of the output. Output files are deflated with libdeflate at every level if "
+                      "bcfdelta was built with it. Use \"-O u\" for uncompressed BCF when piping into another program.",
+                      seqan3::option_spec::standard,
+                      seqan3::value_list_validator{"fast", "balanced", "archive"});
+
+    parser.add_option(level,
+                      'l',
+                      "level",
+                      "Compression level of the output (overrides --profile). -1 means: use the profile.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{-1, 9});
+}
+
+int compression_level(int const level, std::string const & profile)
+{
+    if (level >= 0)
+        return level;
+    else if (profile == "fast")
+        return 1;
+    else if (profile == "archive")
+        return 9;
+    else // balanced
+        return -1;
+}
+
+// io_uring for local files; the depth is the number of 1 MiB blocks in flight
+void add_io_uring_options(seqan3::argument_parser & parser, bool & io_uring, unsigned & depth)
+{
+    parser.add_option(io_uring,
+                      '\0',
+                      "io-uring",
+                      "Read and write local files asynchronously via io_uring (Linux only; falls back to regular I/O "
+                      "if not available).");
+
+    parser.add_option(depth,
+                      '\0',
+                      "read-ahead",
+                      "Number of 1 MiB blocks that are read ahead (or written behind) with --io-uring.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{1, 1024});
+}
+
+/* A read-only stream over a memory-mapped file.
+ * The whole mapping is the get area, so no read() calls are made and the data is not copied into a stream buffer.
+ * This is not zero-copy: the (decompressing) reader still copies the bytes out of the mapping via sgetn().
+ */
+class mmap_istream : public std::istream
+{
+    struct mmap_streambuf : public std::streambuf
+    {
+        char * data = nullptr;
+        size_t size = 0;
+
+        void map(std::filesystem::path const & path)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw delta_error{"Could not open ", path, " for reading."};
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                throw delta_error{"Could not stat ", path, "."};
+            }
+
+            size = st.st_size;
+            if (size > 0)
+            {
+                void * addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+
+                if (addr == MAP_FAILED)
+                    throw delta_error{"Could not memory-map ", path, "."};
+
+                data = static_cast<char *>(addr);
+                ::madvise(data, size, MADV_SEQUENTIAL);
+                ::madvise(data, size, MADV_WILLNEED);
+            }
+            else
+            {
+                ::close(fd);
+            }
+
+            setg(data, data, data + size);
+        }
+
+        ~mmap_streambuf()
+        {
+            if (data != nullptr)
+                ::munmap(data, size);
+        }
+
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (!(which & std::ios_base::in))
+                return pos_type(off_type(-1));
+
+            char * const base = dir == std::ios_base::beg ? eback() : dir == std::ios_base::cur ? gptr() : egptr();
+            if (base + off < eback() || base + off > egptr())
+                return pos_type(off_type(-1));
+
+            setg(eback(), base + off, egptr());
+            return pos_type(gptr() - eback());
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+        {
+            return seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+    };
+
+    mmap_streambuf buf;
+
+public:
+    explicit mmap_istream(std::filesystem::path const & path) : std::istream{nullptr}
+    {
+        buf.map(path);
+        rdbuf(&buf);
+    }
+};
+
+// a transparent_istream that owns the stream it decompresses (base-from-member, so that the stream is created first)
+struct owning_transparent_istream_base
+{
+    std::unique_ptr<std::istream> raw;
+};
+
+class owning_transparent_istream : private owning_transparent_istream_base, public bio::transparent_istream
+{
+public:
+    owning_transparent_istream(std::unique_ptr<std::istream> raw_stream, auto const & options) :
+      owning_transparent_istream_base{std::move(raw_stream)}, bio::transparent_istream{*raw, options}
+    {}
+};
+
+/* Create a reader from a path or from stdin ("-"); local files can optionally be memory-mapped or read via io_uring
+ * (an io_uring_depth of 0 disables io_uring).
+ * When reading from stdin, a memory-mapped file or io_uring, the stream is decompressed by a transparent_istream that
+ * detects the compression from the magic bytes; the first decompressed byte tells BCF ("BCF\2") and VCF
+ * ("##fileformat") apart. If bcfdelta was built with libdeflate, BGZF files are inflated by a bgzf_istream instead.
+ * The stream is stored in the given pointer as it needs to outlive the reader.
+ */
+template <typename reader_options_t>
+auto make_reader(std::filesystem::path const &  path,
+                 reader_options_t const &       reader_options,
+                 bool const                     use_mmap,
+                 std::unique_ptr<std::istream> & stream,
+                 unsigned const                 io_uring_depth = 0)
+{
+    if (path != "-" && io_uring_depth > 0)
+    {
+        stream = make_uring_istream(path, io_uring_depth);
+        if (!stream)
+            std::cerr << "io_uring is not available, falling back to regular I/O.\n";
+    }
+
+    if (path != "-" && use_mmap && !stream)
+        stream.reset(new mmap_istream{path});
+
+    bool const own_bgzf = bgzf_libdeflate && path != "-" && is_bgzf_file(path);
+
+    if (own_bgzf && !stream)
+        stream.reset(new std::ifstream{path, std::ios::binary});
+
+    if (path != "-" && !stream)
+        return bio::var_io::reader{path, reader_options};
+
+    if (own_bgzf)
+        stream.reset(new bgzf_istream{std::move(stream), reader_options.stream_options.threads});
+    else if (stream)
+        stream.reset(new owning_transparent_istream{std::move(stream), reader_options.stream_options});
+    else
+        stream.reset(new bio::transparent_istream{std::cin, reader_options.stream_options});
+
+    if (stream->peek() == 'B')
+        return bio::var_io::reader{*stream, bio::bcf{}, reader_options};
+    else
+        return bio::var_io::reader{*stream, bio::vcf{}, reader_options};
+}
+
+// the output type that the writer chooses for the path if none is given ("-" is BCF)
+std::string deduce_output_type(std::filesystem::path const & path, std::string const & output_type)
+{
+    if (!output_type.empty())
+        return output_type;
+    else if (path == "-" || path.extension() == ".bcf")
+        return "b";
+    else if (path.extension() == ".gz")
+        return "z";
+    else
+        return "v";
+}
+
+void add_write_index_option(seqan3::argument_parser & parser, bool & write_index)
+{
+    parser.add_option(write_index,
+                      '\0',
+                      "write-index",
+                      "Build a CSI index (BCF output) or a TBI index (VCF.gz output) while writing; it is stored next "
+                      "to the output file.");
+}
+
+/* Create a writer for a path or for stdout ("-"); see above for the output types.
+ * Local files can be written via io_uring; the stream is stored in the given pointer as it needs to outlive the writer.
+ * With write_index, the output is compressed by an indexed_ostream instead of the writer, which writes the index
+ * (output file + ".csi" or ".tbi") when it is finished.
+ * With own_bgzf (--profile fast), or always if bcfdelta was built with libdeflate, compressed output to a file is
+ * deflated by a bgzf_ostream (with libdeflate if available); output to stdout is always compressed by the writer.
+ * Call finish_output() after the writer has been destroyed.
+ */
+template <typename writer_options_t>
+auto make_writer(std::filesystem::path const &  path,
+                 std::string                    output_type,
+                 writer_options_t               writer_options,
+                 std::unique_ptr<std::ostream> & stream,
+                 unsigned const                 io_uring_depth = 0,
+                 bool const                     write_index    = false,
+                 bool                           own_bgzf       = false)
+{
+    if (output_type.empty() && path == "-")
+        output_type = "b";
+    else if (!output_type.empty() && output_type != "v" && output_type != "z" && output_type != "b" &&
+             output_type != "u")
+        throw delta_error{"Unknown output type: ", output_type};
+
+    if (path != "-" && io_uring_depth > 0)
+    {
+        stream = make_uring_ostream(path, io_uring_depth);
+
+        if (!stream)
+            std::cerr << "io_uring is not available, falling back to regular I/O.\n";
+        else // deduce from the extension like the writer does for paths
+            output_type = deduce_output_type(path, output_type);
+    }
+
+    // the stream that a BGZF stream writes to
+    auto take_output = [&]()
+    {
+        std::unique_ptr<std::ostream> out = std::move(stream);
+        if (!out)
+        {
+            out.reset(new std::ofstream{path, std::ios::binary});
+            if (!*out)
+                throw delta_error{"Could not open ", path, " for writing."};
+        }
+        return out;
+    };
+
+    own_bgzf = (own_bgzf || bgzf_libdeflate) && !write_index && path != "-" &&
+               (deduce_output_type(path, output_type) == "b" || deduce_output_type(path, output_type) == "z");
+
+    if (write_index)
+    {
+        output_type = deduce_output_type(path, output_type);
+
+        if (path == "-")
+            throw delta_error{"--write-index requires an output file."};
+        if (output_type != "b" && output_type != "z")
+            throw delta_error{"--write-index requires compressed output (BCF or VCF.gz)."};
+
+        std::unique_ptr<std::ostream> out = take_output();
+
+        bool const            bcf        = output_type == "b";
+        std::filesystem::path index_path = path;
+        index_path += bcf ? ".csi" : ".tbi";
+
+        stream.reset(new indexed_ostream{std::move(out),
+                                         std::move(index_path),
+                                         bcf ? index_format_t::csi : index_format_t::tbi,
+                                         writer_options.stream_options.threads,
+                                         writer_options.stream_options.compression_level});
+    }
+    else if (own_bgzf)
+    {
+        output_type = deduce_output_type(path, output_type);
+
+        stream.reset(new bgzf_ostream{take_output(),
+                                      writer_options.stream_options.threads,
+                                      writer_options.stream_options.compression_level});
+    }
+
+    if (output_type.empty())
+        return bio::var_io::writer{path, writer_options};
+
+    writer_options.stream_options.compression =
+      (output_type == "z" || output_type == "b") ? bio::compression_format::bgzf : bio::compression_format::none;
+
+    if (write_index || own_bgzf) // compressed by the indexed_ostream or bgzf_ostream
+        writer_options.stream_options.compression = bio::compression_format::none;
+
+    if (path == "-" || stream)
+    {
+        std::ostream & out = stream ? *stream : std::cout;
+
+        if (output_type == "v" || output_type == "z")
+            return bio::var_io::writer{out, bio::vcf{}, writer_options};
+        else
+            return bio::var_io::writer{out, bio::bcf{}, writer_options};
+    }
+    else
+    {
+        if (output_type == "v" || output_type == "z")
+            return bio::var_io::writer{path, bio::vcf{}, writer_options};
+        else
+            return bio::var_io::writer{path, bio::bcf{}, writer_options};
+    }
+}
+
+/* Finish the output stream of make_writer() after the writer has been destroyed (the writer may still write when it
+ * is destroyed): BGZF streams deflate and write the remaining data and the EOF marker (and the index if requested),
+ * then the file (regular or io_uring) is flushed and closed. Errors are thrown as delta_error; the destructors of the
+ * streams only swallow them while the stack is unwound because of another error.
+ */
+void finish_output(std::unique_ptr<std::ostream> & stream)
+{
+    if (!stream)
+        return;
+
+    if (indexed_ostream * indexed = dynamic_cast<indexed_ostream *>(stream.get()); indexed != nullptr)
+        indexed->finish();
+    else if (bgzf_ostream * bgzf = dynamic_cast<bgzf_ostream *>(stream.get()); bgzf != nullptr)
+        bgzf->finish();
+    else
+        close_output_stream(*stream);
+
+    stream.reset();
+}
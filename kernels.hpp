@@ -0,0 +1,238 @@
+#pragma once
+
+#include <map>
+#include <utility>
+
+#include <bio/var_io/reader.hpp>
+
+#include "shared.hpp"
+
+// the variant that holds the value of a FORMAT field
+using genotype_value_t =
+  decltype(std::ranges::range_value_t<decltype(std::declval<bio::var_io::default_record<> &>().genotypes())>::value);
+
+/* A kernel applies the delta_visitor to one specific pair of types and one class of Number, so that there is no
+ * variant dispatch and no switch over the Number; everything is inlined, which leaves a fixed loop shape for the
+ * compiler. The kernel also checks that there are not more values than samples in the header.
+ */
+template <typename visitor_t>
+using format_kernel_t = void (*)(visitor_t const &, size_t, genotype_value_t const &, genotype_value_t &);
+
+template <typename visitor_t, number_class_t number_class, size_t last_i, size_t cur_i>
+[[gnu::flatten]] void format_kernel(visitor_t const &        visitor,
+                                    size_t const             n_sample_hdr,
+                                    genotype_value_t const & last,
+                                    genotype_value_t &       cur)
+{
+    auto const & last_rng = *std::get_if<last_i>(&last);
+    auto &       cur_rng  = *std::get_if<cur_i>(&cur);
+
+    if (size_t const n_sample = std::min(last_rng.size(), cur_rng.size()); n_sample > n_sample_hdr)
+    {
+        throw delta_error{"Current range has more entries (",
+                          n_sample,
+                          ") than there are samples in header (",
+                          n_sample_hdr,
+                          ")."};
+    }
+
+    visitor.template apply<number_class>(last_rng, cur_rng);
+}
+
+template <typename visitor_t>
+void incompatible_format_kernel(visitor_t const & visitor, size_t, genotype_value_t const &, genotype_value_t &)
+{
+    throw delta_error{"The type of this record's ", visitor.id, " field is not compatible with the previous record."};
+}
+
+// kernel for the given (reference type, current type, Number class)
+template <typename visitor_t, number_class_t number_class, size_t last_i, size_t cur_i>
+constexpr format_kernel_t<visitor_t> select_format_kernel()
+{
+    using last_rng_t          = std::variant_alternative_t<last_i, genotype_value_t>;
+    using cur_rng_t           = std::variant_alternative_t<cur_i, genotype_value_t>;
+    using last_alph           = seqan3::range_innermost_value_t<last_rng_t>;
+    using cur_alph            = seqan3::range_innermost_value_t<cur_rng_t>;
+    constexpr size_t last_dim = seqan3::range_dimension_v<last_rng_t>;
+    constexpr size_t cur_dim  = seqan3::range_dimension_v<cur_rng_t>;
+
+    if constexpr (!compatible_alph<last_alph, cur_alph> || last_dim != cur_dim)
+        return &incompatible_format_kernel<visitor_t>;
+    else if constexpr (cur_dim != 2 || std::same_as<cur_alph, char>) // Number only matters for vectors of numbers
+        return &format_kernel<visitor_t, number_class_t::fixed, last_i, cur_i>;
+    else
+        return &format_kernel<visitor_t, number_class, last_i, cur_i>;
+}
+
+template <typename visitor_t>
+constexpr auto make_format_kernel_table()
+{
+    constexpr size_t n_types   = std::variant_size_v<genotype_value_t>;
+    constexpr size_t n_classes = static_cast<size_t>(number_class_t::size);
+
+    std::array<std::array<std::array<format_kernel_t<visitor_t>, n_types>, n_types>, n_classes> table{};
+
+    [&]<size_t... idx>(std::index_sequence<idx...>)
+    {
+        ((table[idx / (n_types * n_types)][idx / n_types % n_types][idx % n_types] =
+            select_format_kernel<visitor_t,
+                                 static_cast<number_class_t>(idx / (n_types * n_types)),
+                                 idx / n_types % n_types,
+                                 idx % n_types>()),
+         ...);
+    }(std::make_index_sequence<n_classes * n_types * n_types>{});
+
+    return table;
+}
+
+// table of kernels indexed by [Number class][reference type][current type]
+template <typename visitor_t>
+inline constexpr auto format_kernel_table = make_format_kernel_table<visitor_t>();
+
+// STRING fields other than GT mark the samples whose value equals the reference's (see delta_visitor)
+bool is_string_format(bio::var_io::header::format_t const & format)
+{
+    return format.id != "GT" && (format.type_id == bio::var_io::value_type_id::string ||
+                                 format.type_id == bio::var_io::value_type_id::vector_of_string);
+}
+
+// the INFO field that lists the replaced samples of a STRING field
+std::string same_runs_id(std::string_view const format_id)
+{
+    return "DELTA_SAME_" + std::string{format_id};
+}
+
+/* The FORMAT fields that are delta-compressed, with the classes of their Number, computed once per header.
+ * Records are then encoded and decoded by looking up the field and calling its kernel directly.
+ * The delta-compressed INFO fields are also listed; the DELTA_* fields and fields that are not declared in the header
+ * are never delta-compressed.
+ */
+struct format_plan_t
+{
+    struct field_t
+    {
+        int32_t        number;
+        number_class_t number_class;
+        std::string    name;      // "FORMAT/ID", used for tracing
+        bool           is_string; // see is_string_format()
+        std::string    same_id;   // see same_runs_id()
+    };
+
+    // a delta-compressed field that is present in the current and in the last record
+    struct match_t
+    {
+        size_t          cur_pos;  // position in the genotypes of the current record
+        size_t          last_pos; // position in the genotypes of the last record
+        field_t const * field;
+    };
+
+    bio::var_io::header const &                 hdr;
+    size_t                                      n_sample_hdr = 0;
+    std::map<std::string, field_t, std::less<>> fields;
+    std::map<std::string, int32_t, std::less<>> info_fields; // ID -> Number
+
+    // the layout of the records in the last call to resolve()
+    mutable std::vector<std::string> layout_ids;
+    mutable std::vector<std::string> layout_last_ids;
+    mutable std::vector<match_t>     layout_matches;
+
+    explicit format_plan_t(bio::var_io::header const & hdr) :
+      hdr{hdr}, n_sample_hdr{hdr.column_labels.size() > 9 ? hdr.column_labels.size() - 9 : 0}
+    {
+        for (bio::var_io::header::format_t const & format : hdr.formats)
+        {
+            if (format.other_fields.contains("Encoding") && format.other_fields.at("Encoding") == "Delta")
+            {
+                fields.emplace(format.id,
+                               field_t{format.number,
+                                       to_number_class(format.number),
+                                       "FORMAT/" + format.id,
+                                       is_string_format(format),
+                                       same_runs_id(format.id)});
+            }
+        }
+
+        for (bio::var_io::header::info_t const & info : hdr.infos)
+        {
+            if (!info.id.starts_with("DELTA_") && info.other_fields.contains("Encoding") &&
+                info.other_fields.at("Encoding") == "Delta")
+            {
+                info_fields.emplace(info.id, info.number);
+            }
+        }
+    }
+
+    // the field if it is delta-compressed, nullptr otherwise
+    field_t const * find(std::string_view const id) const
+    {
+        auto it = fields.find(id);
+        return it == fields.end() ? nullptr : &it->second;
+    }
+
+    // the Number of the INFO field if it is delta-compressed, nullptr otherwise
+    int32_t const * find_info(std::string_view const id) const
+    {
+        auto it = info_fields.find(id);
+        return it == info_fields.end() ? nullptr : &it->second;
+    }
+
+    /* The delta-compressed fields of the record that are also present in the last record.
+     * Records usually have the same FORMAT fields in the same order, so the result of the previous call is reused if
+     * the IDs are the same; this makes the plan not thread-safe (every thread has its own plan).
+     */
+    std::vector<match_t> const & resolve(bio::var_io::default_record<> const & last_record,
+                                         bio::var_io::default_record<> const & record) const
+    {
+        auto same_ids = [](auto const & genotypes, std::vector<std::string> const & ids)
+        {
+            return std::ranges::equal(genotypes,
+                                      ids,
+                                      std::ranges::equal_to{},
+                                      [](auto const & genotype) -> std::string const & { return genotype.id; });
+        };
+
+        if (same_ids(record.genotypes(), layout_ids) && same_ids(last_record.genotypes(), layout_last_ids))
+            return layout_matches;
+
+        layout_ids.clear();
+        layout_last_ids.clear();
+        layout_matches.clear();
+
+        for (auto const & genotype : record.genotypes())
+            layout_ids.push_back(genotype.id);
+        for (auto const & genotype : last_record.genotypes())
+            layout_last_ids.push_back(genotype.id);
+
+        for (size_t i = 0; i < layout_ids.size(); ++i)
+        {
+            field_t const * field = find(layout_ids[i]);
+            if (field == nullptr)
+                continue;
+
+            if (auto it = std::ranges::find(layout_last_ids, layout_ids[i]); it != layout_last_ids.end())
+                layout_matches.push_back(match_t{i, static_cast<size_t>(it - layout_last_ids.begin()), field});
+        }
+
+        return layout_matches;
+    }
+
+    template <typename op_t, bool skip_problematic>
+    void run(field_t const &          field,
+             std::string_view const   id,
+             size_t const             n_alts,
+             genotype_value_t const & last,
+             genotype_value_t &       cur,
+             size_t const             sample_begin = 0,
+             size_t const             sample_end   = std::numeric_limits<size_t>::max(),
+             std::vector<int32_t> *   same_runs    = nullptr) const
+    {
+        using visitor_t = delta_visitor<op_t, skip_problematic>;
+
+        visitor_t const visitor{id, field.number, n_alts, sample_begin, sample_end, same_runs};
+
+        format_kernel_t<visitor_t> const kernel =
+          format_kernel_table<visitor_t>[static_cast<size_t>(field.number_class)][last.index()][cur.index()];
+
+        kernel(visitor, n_sample_hdr, last, cur);
+    }
+};
@@ -1,26 +1,33 @@
 
 #include <seqan3/argument_parser/all.hpp>
 
+#include "bench.hpp"
 #include "decode.hpp"
 #include "encode.hpp"
+#include "reanchor.hpp"
 
 static_assert(bio::compression_traits<bio::compression_format::bgzf>::available);
 
 int main(int argc, char ** argv)
 {
+    std::ios::sync_with_stdio(false); // we may read from std::cin and write to std::cout
+
     seqan3::argument_parser top_level_parser{
       "bcfdelta",
       argc,
       argv,
       seqan3::update_notifications::off,
-      {"encode", "decode"}
+      {"encode", "decode", "reanchor", "bench"}
     };
 
     top_level_parser.info.version           = version;
     top_level_parser.info.date              = date;
     top_level_parser.info.short_description = "Losslessly compress VCF and BCF files.";
-    top_level_parser.info.synopsis.push_back("bcfdelta encode input_file[.vcf.gz|.bcf] output_file[.vcf.gz|.bcf]");
-    top_level_parser.info.synopsis.push_back("bcfdelta decode input_file[.vcf.gz|.bcf] output_file[.vcf.gz|.bcf]");
+    top_level_parser.info.synopsis.push_back("bcfdelta encode input_file[.vcf.gz|.bcf|-] output_file[.vcf.gz|.bcf|-]");
+    top_level_parser.info.synopsis.push_back("bcfdelta decode input_file[.vcf.gz|.bcf|-] output_file[.vcf.gz|.bcf|-]");
+    top_level_parser.info.synopsis.push_back(
+      "bcfdelta reanchor input_file[.vcf.gz|.bcf|-] output_file[.vcf.gz|.bcf|-]");
+    top_level_parser.info.synopsis.push_back("bcfdelta bench [--baseline file.json] [--write-baseline file.json]");
 
     try
     {
@@ -38,6 +45,16 @@ int main(int argc, char ** argv)
             decode_options_t options = parse_decode_arguments(sub_parser);
             decode(options);
         }
+        else if (sub_parser.info.app_name == "bcfdelta-reanchor")
+        {
+            reanchor_options_t options = parse_reanchor_arguments(sub_parser);
+            reanchor(options);
+        }
+        else if (sub_parser.info.app_name == "bcfdelta-bench")
+        {
+            bench_options_t options = parse_bench_arguments(sub_parser);
+            bench(options);
+        }
         else
         {
             std::cerr << "Unknown subcommand: " << sub_parser.info.app_name << '\n';
@@ -0,0 +1,239 @@
+#pragma once
+
+/* Support for running with a memory budget (--max-memory).
+ * Instead of a full copy of the last bi-allelic record, only its "reference state" is kept: the fields that
+ * subsequent records are delta-compressed against, with integers in the narrowest type that holds their values.
+ * Batches and the auto-tuning sample are limited by the approximate memory of their records, and the resident memory
+ * is sampled while running, so that batches and queues can be shrunk when the process exceeds the budget.
+ */
+
+#include <fstream>
+#include <span>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#    include <malloc.h>
+#endif
+
+#include <bio/var_io/reader.hpp>
+
+#include "kernels.hpp"
+#include "shared.hpp"
+
+inline constexpr size_t mebibyte = 1024 * 1024;
+
+// peak resident set size of the process in bytes
+size_t peak_memory()
+{
+    rusage usage{};
+    if (::getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // KiB on Linux
+}
+
+// current resident set size of the process in bytes (0 if unknown)
+size_t current_memory()
+{
+    std::ifstream statm{"/proc/self/statm"};
+    size_t        pages    = 0;
+    size_t        resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+/* Samples the resident memory every few records. If it is above the budget after returning freed memory to the
+ * system, the caller has to shrink its buffers (see encode).
+ */
+class memory_governor_t
+{
+public:
+    // budget in MiB, 0 means no limit
+    explicit memory_governor_t(size_t const budget) : budget{budget * mebibyte} {}
+
+    bool over_budget()
+    {
+        if (budget == 0 || ++calls % check_interval != 0 || current_memory() <= budget)
+            return false;
+
+#ifdef __GLIBC__
+        ::malloc_trim(0);
+#endif
+        return current_memory() > budget;
+    }
+
+private:
+    static constexpr size_t check_interval = 64;
+
+    size_t const budget;
+    size_t       calls = 0;
+};
+
+// approximate heap memory of a (nested) range of values
+template <typename rng_t>
+size_t range_memory(rng_t const & rng)
+{
+    using alph_t         = seqan3::range_innermost_value_t<rng_t>;
+    constexpr size_t dim = seqan3::range_dimension_v<rng_t>;
+
+    if constexpr (dim == 1)
+    {
+        return std::ranges::size(rng) * sizeof(alph_t);
+    }
+    else if constexpr (dim == 2 && requires { rng.concat_size(); })
+    {
+        return rng.concat_size() * sizeof(alph_t) + std::ranges::size(rng) * sizeof(size_t);
+    }
+    else
+    {
+        size_t ret = 0;
+        for (auto && elem : rng)
+            ret += range_memory(elem) + sizeof(size_t);
+        return ret;
+    }
+}
+
+// approximate heap memory of the FORMAT values of a record (INFO values are negligible)
+size_t record_memory(bio::var_io::default_record<> const & record)
+{
+    size_t ret = 0;
+    for (auto const & genotype : record.genotypes())
+        ret += std::visit([](auto const & rng) { return range_memory(rng); }, genotype.value);
+    return ret;
+}
+
+// copy the integers into a value of the smaller integer type; missing values are retained
+template <typename small_t, typename rng_t>
+void copy_narrowed_as(rng_t const & rng, genotype_value_t & out)
+{
+    using alph_t         = seqan3::range_innermost_value_t<rng_t>;
+    constexpr size_t dim = seqan3::range_dimension_v<rng_t>;
+
+    auto narrow = [](alph_t const value) -> small_t
+    {
+        return value == bio::var_io::missing_value<alph_t> ? bio::var_io::missing_value<small_t>
+                                                           : static_cast<small_t>(value);
+    };
+
+    if constexpr (dim == 1)
+    {
+        if (!std::holds_alternative<std::vector<small_t>>(out))
+            out.emplace<std::vector<small_t>>();
+
+        std::vector<small_t> & values = std::get<std::vector<small_t>>(out);
+        values.resize(rng.size());
+        std::ranges::transform(rng, values.begin(), narrow);
+    }
+    else
+    {
+        using values_t = seqan3::concatenated_sequences<std::vector<small_t>>;
+
+        if (!std::holds_alternative<values_t>(out))
+            out.emplace<values_t>();
+
+        values_t & values = std::get<values_t>(out);
+        values.clear();
+        values.reserve(rng.size());
+        values.concat_reserve(rng.concat_size());
+        for (auto && inner : rng)
+        {
+            values.push_back();
+            for (alph_t const value : inner)
+                values.last_push_back(narrow(value));
+        }
+    }
+}
+
+// copy the value; integers are stored in the narrowest type that holds all of them
+void copy_narrowed(genotype_value_t const & in, genotype_value_t & out)
+{
+    auto fun = [&]<typename rng_t>(rng_t const & rng)
+    {
+        using alph_t         = seqan3::range_innermost_value_t<rng_t>;
+        constexpr size_t dim = seqan3::range_dimension_v<rng_t>;
+
+        if constexpr (std::integral<alph_t> && !std::same_as<alph_t, char> && sizeof(alph_t) > 1 &&
+                      (dim == 1 || dim == 2))
+        {
+            std::span<alph_t const> values;
+            if constexpr (dim == 1)
+                values = std::span<alph_t const>{rng.data(), rng.size()};
+            else
+                values = rng.concat();
+
+            int64_t min = 0;
+            int64_t max = 0;
+            for (alph_t const value : values)
+            {
+                if (value != bio::var_io::missing_value<alph_t>)
+                {
+                    min = std::min<int64_t>(min, value);
+                    max = std::max<int64_t>(max, value);
+                }
+            }
+
+            if (min >= min_regular_value<int8_t> && max <= std::numeric_limits<int8_t>::max())
+                copy_narrowed_as<int8_t>(rng, out);
+            else if (sizeof(alph_t) > 2 && min >= min_regular_value<int16_t> &&
+                     max <= std::numeric_limits<int16_t>::max())
+                copy_narrowed_as<int16_t>(rng, out);
+            else
+                out = rng;
+        }
+        else
+        {
+            out = rng;
+        }
+    };
+
+    std::visit(fun, in);
+}
+
+/* Copy the reference state of the record into state: the position, the ALT alleles (to tell bi-allelic records
+ * apart) and the delta-compressed INFO and FORMAT fields. This is all that starts_new_block(), do_delta() and
+ * undo_delta() access of the last record. The buffers of state are reused.
+ */
+void copy_reference_state(bio::var_io::default_record<> const & record,
+                          bio::var_io::default_record<> &       state,
+                          format_plan_t const &                 plan)
+{
+    state.chrom() = record.chrom();
+    state.pos()   = record.pos();
+    state.alt()   = record.alt();
+
+    state.info().clear();
+    for (auto const & info : record.info())
+    {
+        if (plan.find_info(info.id) != nullptr)
+            state.info().push_back(info);
+    }
+
+    size_t n = 0;
+    for (auto const & genotype : record.genotypes())
+    {
+        if (plan.find(genotype.id) == nullptr)
+            continue;
+
+        if (n == state.genotypes().size())
+            state.genotypes().emplace_back();
+
+        auto & kept = state.genotypes()[n++];
+        kept.id     = genotype.id;
+        copy_narrowed(genotype.value, kept.value);
+    }
+    state.genotypes().resize(n);
+}
+
+// print the peak memory usage and whether it was within the budget (in MiB)
+void report_memory(size_t const budget)
+{
+    size_t const peak = peak_memory();
+
+    std::cerr << "Peak memory usage: " << (peak + mebibyte - 1) / mebibyte << " MiB (budget: " << budget
+              << " MiB).\n";
+
+    if (peak > budget * mebibyte)
+        std::cerr << "The budget was exceeded; single records of this file may be larger than the budget allows.\n";
+}
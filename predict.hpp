@@ -0,0 +1,197 @@
+#pragma once
+
+#include <map>
+
+#include <bio/var_io/reader.hpp>
+
+#include "shared.hpp"
+
+/* Predictors for integer FORMAT fields, selected via the Encoding attribute in the header:
+ * MovingAvg4: the mean of the last four values of the sample.
+ * Linear:     extrapolation from the last two values of the sample.
+ * Predictions are made from the previous bi-allelic records of the same block; missing values in these records
+ * are ignored. The history is reset at every reference record ("anchor"), so that blocks stay independent.
+ */
+inline constexpr std::array<std::string_view, 2> predictor_names{"MovingAvg4", "Linear"};
+
+// the predictor of one field; holds the values of the last records of the block
+class field_predictor_t
+{
+public:
+    using values_t = seqan3::concatenated_sequences<std::vector<int32_t>>;
+
+    explicit field_predictor_t(std::string_view const name) : linear{name == "Linear"}, history(linear ? 2 : 4) {}
+
+    void reset() { size = 0; }
+
+    void push(values_t const & values)
+    {
+        history[next] = values;
+        next          = (next + 1) % history.size();
+        size          = std::min(size + 1, history.size());
+    }
+
+    // predict value j of sample i
+    int64_t predict(size_t const i, size_t const j) const
+    {
+        int64_t known[4];
+        size_t  n_known = 0;
+
+        // newest first
+        for (size_t k = 0; k < size; ++k)
+        {
+            values_t const & values = history[(next + history.size() - 1 - k) % history.size()];
+            if (i < values.size() && j < values[i].size() && values[i][j] != bio::var_io::missing_value<int32_t>)
+                known[n_known++] = values[i][j];
+        }
+
+        if (n_known == 0)
+            return 0;
+        else if (linear)
+            return n_known == 1 ? known[0] : 2 * known[0] - known[1];
+
+        int64_t sum = 0;
+        for (size_t k = 0; k < n_known; ++k)
+            sum += known[k];
+        return sum / static_cast<int64_t>(n_known);
+    }
+
+private:
+    bool const            linear;
+    std::vector<values_t> history; // ring buffer
+    size_t                next = 0;
+    size_t                size = 0;
+};
+
+// the predictors of all fields in a header
+struct predictor_t
+{
+    using values_t = field_predictor_t::values_t;
+
+    std::map<std::string, field_predictor_t, std::less<>> fields;
+
+    values_t values;
+    values_t transformed;
+
+    explicit predictor_t(bio::var_io::header const & hdr)
+    {
+        for (bio::var_io::header::format_t const & format : hdr.formats)
+        {
+            auto it = format.other_fields.find("Encoding");
+            if (it != format.other_fields.end() &&
+                std::ranges::find(predictor_names, it->second) != predictor_names.end())
+                fields.emplace(format.id, field_predictor_t{it->second});
+        }
+    }
+
+    bool empty() const { return fields.empty(); }
+
+    // replace the values of predicted fields by the residuals
+    void encode(bio::var_io::default_record<> & record, bool const is_reference)
+    {
+        transform<true>(record, is_reference);
+    }
+
+    // replace the residuals of predicted fields by the values
+    void decode(bio::var_io::default_record<> & record, bool const is_reference)
+    {
+        transform<false>(record, is_reference);
+    }
+
+private:
+    // read the values of an integer field as int32; returns the dimension of the field
+    size_t read_values(auto const & field_value, std::string_view const id)
+    {
+        auto fun = [&]<typename rng_t>(rng_t const & rng) -> size_t
+        {
+            using alph_t         = seqan3::range_innermost_value_t<rng_t>;
+            constexpr size_t dim = seqan3::range_dimension_v<rng_t>;
+
+            values.clear();
+
+            if constexpr (std::integral<alph_t> && !std::same_as<alph_t, char> && dim == 1)
+            {
+                values.reserve(rng.size());
+                for (alph_t const value : rng)
+                {
+                    values.push_back();
+                    values.last_push_back(widen_int(value));
+                }
+            }
+            else if constexpr (std::integral<alph_t> && !std::same_as<alph_t, char> && dim == 2)
+            {
+                values.reserve(rng.size());
+                values.concat_reserve(rng.concat_size());
+                for (auto && inner : rng)
+                {
+                    values.push_back();
+                    for (alph_t const value : inner)
+                        values.last_push_back(widen_int(value));
+                }
+            }
+            else
+            {
+                throw delta_error{"Predictors are only supported for integer fields, but ", id, " is not one."};
+            }
+
+            return dim;
+        };
+
+        return std::visit(fun, field_value);
+    }
+
+    template <bool encode>
+    void transform(bio::var_io::default_record<> & record, bool const is_reference)
+    {
+        if (fields.empty())
+            return;
+
+        bool const is_biallelic = record.alt().size() == 1;
+
+        for (auto & genotype : record.genotypes())
+        {
+            auto fit = fields.find(genotype.id);
+            if (fit == fields.end())
+                continue;
+
+            field_predictor_t & predictor = fit->second;
+            size_t const        dim       = read_values(genotype.value, genotype.id);
+
+            if (is_reference) // stored as-is
+            {
+                predictor.reset();
+                predictor.push(values);
+                continue;
+            }
+
+            transformed.clear();
+            transformed.reserve(values.size());
+            transformed.concat_reserve(values.concat_size());
+
+            for (size_t i = 0; i < values.size(); ++i)
+            {
+                transformed.push_back();
+                for (size_t j = 0; j < values[i].size(); ++j)
+                {
+                    int32_t const value = values[i][j];
+                    if (value == bio::var_io::missing_value<int32_t>)
+                        transformed.last_push_back(value);
+                    else if constexpr (encode) // throws instead of wrapping or hitting a reserved value
+                        transformed.last_push_back(checked_int<int32_t>(value - predictor.predict(i, j)));
+                    else
+                        transformed.last_push_back(checked_int<int32_t>(value + predictor.predict(i, j)));
+                }
+            }
+
+            // the history holds the original values
+            if (is_biallelic)
+                predictor.push(encode ? values : transformed);
+
+            // always int32; the writer picks the smallest suitable width
+            if (dim == 1)
+                genotype.value = std::vector<int32_t>(transformed.concat().begin(), transformed.concat().end());
+            else
+                genotype.value = transformed;
+        }
+    }
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <seqan3/argument_parser/all.hpp>
+
+#include <bio/var_io/reader.hpp>
+#include <bio/var_io/writer.hpp>
+
+#include "checksum.hpp"
+#include "decode.hpp"
+#include "encode_delta.hpp"
+#include "io.hpp"
+#include "memory.hpp"
+#include "predict.hpp"
+#include "shared.hpp"
+
+struct reanchor_options_t
+{
+    std::filesystem::path input;
+    std::filesystem::path output;
+    std::string           output_type;
+    uint64_t              ref_freq   = 10'000;
+    bool                  mmap       = false;
+    int                   level      = -1;
+    std::string           profile    = "balanced";
+    bool                  io_uring   = false;
+    unsigned              read_ahead = 8;
+    size_t                max_memory = 0;
+    size_t                threads    = std::max<size_t>(2, std::min<size_t>(8, std::thread::hardware_concurrency()));
+};
+
+reanchor_options_t parse_reanchor_arguments(seqan3::argument_parser & parser)
+{
+    parser.info.short_description = "Change the reference frequency of an already encoded file.";
+    parser.info.version           = version;
+    parser.info.date              = date;
+    parser.info.synopsis.push_back("bcfdelta reanchor input_file[.vcf.gz|.bcf|-] output_file[.vcf.gz|.bcf|-]");
+
+    reanchor_options_t options{};
+
+    parser.add_positional_option(options.input,
+                                 "The input file (must be encoded, \"-\" for stdin).",
+                                 input_path_validator{});
+    parser.add_positional_option(options.output,
+                                 "The output file (\"-\" for stdout).");
+
+    add_output_type_option(parser, options.output_type);
+
+    parser.add_subsection("Performance:");
+
+    parser.add_option(options.threads,
+                      '@',
+                      "threads",
+                      "Maximum number of threads to use.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{2u, std::thread::hardware_concurrency() * 2});
+
+    add_compression_options(parser, options.level, options.profile);
+
+    parser.add_option(options.mmap,
+                      '\0',
+                      "mmap",
+                      "Memory-map the input file (local files only). This only saves the read() calls; it is not "
+                      "zero-copy, the data is still copied when it is decompressed and parsed.");
+
+    add_io_uring_options(parser, options.io_uring, options.read_ahead);
+
+    parser.add_option(options.max_memory,
+                      '\0',
+                      "max-memory",
+                      "Try to stay within this many MiB by decoding buffered records early and keeping only the state "
+                      "that is needed for re-encoding subsequent records. Reports the peak memory usage. 0 means no "
+                      "limit.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{0, 16 * 1024 * 1024});
+
+    parser.add_subsection("Tuning:");
+
+    parser.add_option(options.ref_freq,
+                      'f',
+                      "ref-freq",
+                      "Keep an uncompressed record every N basepairs.",
+                      seqan3::option_spec::standard,
+                      seqan3::arithmetic_range_validator{100, 1'000'000});
+
+    parser.parse();
+
+    return options;
+}
+
+/* Records are always delta-compressed against the previous bi-allelic record, so changing the reference frequency
+ * only affects the records that become or stop being references. All other records are passed through as they are.
+ * Decoding is lazy: the bi-allelic records since the last reference of the input are kept as they are and are only
+ * decoded when a later record of the same block becomes or stops being a reference, or when more than
+ * reanchor_max_pending of them (or a quarter of the --max-memory budget) are kept. So short blocks that keep their
+ * anchor and do not get a new one are never decoded.
+ * Block checksums (DELTA_SUM) cover the decoded records, so if the input has them, every record is decoded and the
+ * checksums are computed anew for the new blocks.
+ * Fields with a predictor depend on all previous records of the block, so they are always decoded and re-encoded.
+ */
+inline constexpr size_t reanchor_max_pending = 256;
+
+void reanchor(reanchor_options_t const & options)
+{
+    size_t threads        = options.threads - 1; // subtract one for the main thread
+    size_t reader_threads = threads / 3;
+    size_t writer_threads = threads - reader_threads;
+
+    auto reader_options =
+      bio::var_io::reader_options{.field_types    = bio::var_io::field_types<bio::ownership::deep>,
+                                  .stream_options = bio::transparent_istream_options{.threads = reader_threads + 1}};
+
+    unsigned const io_uring_depth = options.io_uring ? options.read_ahead : 0;
+
+    std::unique_ptr<std::istream> input_stream;
+    auto                          reader =
+      make_reader(options.input, reader_options, options.mmap, input_stream, io_uring_depth);
+
+    auto writer_options =
+      bio::var_io::writer_options{.stream_options = bio::transparent_ostream_options{.threads = writer_threads + 1}};
+    writer_options.stream_options.compression_level = compression_level(options.level, options.profile);
+
+    std::unique_ptr<std::ostream> output_stream;
+    std::optional                 writer{make_writer(options.output,
+                                                     options.output_type,
+                                                     writer_options,
+                                                     output_stream,
+                                                     io_uring_depth,
+                                                     false,
+                                                     options.profile == "fast")};
+
+    bio::var_io::header const & hdr = reader.header();
+
+    if (!hdr.string_to_info_pos().contains("DELTA_COMP") || !hdr.string_to_info_pos().contains("DELTA_REF"))
+    {
+        std::cerr << "The input file does not seem to be delta-compressed already. Exiting.\n";
+        std::exit(1);
+    }
+
+    // records that stop being references are encoded like encode did (files without the attribute used the default)
+    auto const & comp_fields      = hdr.infos[hdr.string_to_info_pos().at("DELTA_COMP")].other_fields;
+    bool const   skip_problematic = !comp_fields.contains("SkipProblematic") ||
+                                  comp_fields.at("SkipProblematic") != "false";
+
+    writer->set_header(hdr);
+
+    bool const        bounded       = options.max_memory > 0;
+    size_t const      buffer_budget = options.max_memory * mebibyte / 4;
+    memory_governor_t governor{options.max_memory};
+
+    // the last bi-allelic record before the pending records, in decoded state (only its reference state if bounded)
+    bio::var_io::default_record<> ref_record;
+    bio::var_io::default_record<> bak_record;
+    ref_record.chrom() = "invalid";
+    ref_record.pos()   = -1;
+
+    // the bi-allelic records since the last reference that have not been decoded (buffers are reused)
+    std::vector<bio::var_io::default_record<>> pending;
+    size_t                                     n_pending      = 0;
+    size_t                                     pending_memory = 0; // only tracked with a memory budget
+
+    // the checksums of the input become invalid when blocks change, so they are computed from the decoded records
+    bool const                    checksum = hdr.string_to_info_pos().contains("DELTA_SUM");
+    bio::var_io::default_record<> original;    // the current record in decoded state
+    bio::var_io::default_record<> held_record; // held back until we know whether it ends a block
+    bool                          has_held = false;
+    block_checksum_t              block_checksum;
+
+    format_plan_t plan{hdr};
+    predictor_t   in_predictor{hdr};
+    predictor_t   out_predictor{hdr};
+
+    // the decoded record becomes the reference for the following records
+    auto keep_reference = [&](bio::var_io::default_record<> & decoded)
+    {
+        if (bounded)
+            copy_reference_state(decoded, ref_record, plan);
+        else
+            std::swap(ref_record, decoded);
+    };
+
+    // decode the pending records, so that ref_record is the last bi-allelic record
+    auto decode_pending = [&]()
+    {
+        for (size_t k = 0; k < n_pending; ++k)
+        {
+            undo_delta(ref_record, pending[k], plan);
+            keep_reference(pending[k]);
+        }
+        n_pending      = 0;
+        pending_memory = 0;
+    };
+
+    // write the record; with checksums, it is held back and record is swapped with the previous one
+    auto emit = [&](bio::var_io::default_record<> & record, bool const is_reference)
+    {
+        if (!checksum)
+        {
+            writer->push_back(record);
+            return;
+        }
+
+        if (has_held)
+        {
+            if (is_reference) // held record ends a block
+                held_record.info().push_back({.id = "DELTA_SUM", .value = block_checksum.finish()});
+            writer->push_back(held_record);
+        }
+
+        block_checksum.add(original);
+        std::swap(held_record, record);
+        has_held = true;
+    };
+
+    auto is_delta_flag = [](auto const & info) { return info.id == "DELTA_REF" || info.id == "DELTA_COMP"; };
+
+    for (bio::var_io::default_record<> & record : reader)
+    {
+        std::erase_if(record.info(), [](auto const & info) { return info.id == "DELTA_SUM"; });
+
+        if (governor.over_budget()) // release the buffers of the pending records
+        {
+            decode_pending();
+            pending.clear();
+            pending.shrink_to_fit();
+        }
+
+        // only the position of the last bi-allelic record is needed to tell references apart
+        bio::var_io::default_record<> const & last_record = n_pending > 0 ? pending[n_pending - 1] : ref_record;
+
+        bool const was_reference  = std::ranges::any_of(record.info(),
+                                                        [](auto const & info) { return info.id == "DELTA_REF"; });
+        bool const was_compressed = std::ranges::any_of(record.info(),
+                                                        [](auto const & info) { return info.id == "DELTA_COMP"; });
+        bool const is_reference   = starts_new_block(last_record, record, options.ref_freq);
+        bool const is_biallelic   = record.alt().size() == 1;
+
+        // older versions could write multi-allelic anchors, which later records of the input are compressed against
+        if (was_reference && !is_biallelic)
+        {
+            throw delta_error{"The anchor record at ", record.chrom(), ":", record.pos(), " is multi-allelic. Files "
+                              "with multi-allelic anchors cannot be reanchored; decode and encode them instead."};
+        }
+
+        in_predictor.decode(record, was_reference);
+
+        if (checksum) // there are no pending records in this case, so ref_record is the last bi-allelic record
+        {
+            original = record;
+            if (was_compressed)
+                undo_delta(ref_record, original, plan);
+        }
+
+        out_predictor.encode(record, is_reference);
+
+        if (is_reference && !was_reference) // record becomes reference
+        {
+            decode_pending();
+
+            std::erase_if(record.info(), is_delta_flag);
+            undo_delta(ref_record, record, plan);
+            record.info().push_back({.id = "DELTA_REF", .value = true});
+        }
+        else if (was_reference && !is_reference) // record stops being reference
+        {
+            decode_pending();
+
+            std::erase_if(record.info(), is_delta_flag);
+            bak_record = record;
+
+            record.info().push_back({.id = "DELTA_COMP", .value = true});
+            do_delta(ref_record, record, plan, skip_problematic);
+        }
+
+        emit(record, is_reference);
+
+        if (!is_biallelic) // multi-allelic records are never references
+            continue;
+
+        if (checksum)
+        {
+            keep_reference(original);
+        }
+        else if (is_reference) // stored as-is, the pending records are not needed anymore
+        {
+            n_pending = 0;
+            keep_reference(record);
+        }
+        else if (was_reference)
+        {
+            keep_reference(bak_record);
+        }
+        else
+        {
+            if (n_pending == pending.size())
+                pending.emplace_back();
+            std::swap(pending[n_pending++], record);
+
+            if (bounded)
+                pending_memory += record_memory(pending[n_pending - 1]);
+
+            if (n_pending > reanchor_max_pending || pending_memory > buffer_budget)
+                decode_pending();
+        }
+    }
+
+    if (has_held) // the last record ends the last block
+    {
+        held_record.info().push_back({.id = "DELTA_SUM", .value = block_checksum.finish()});
+        writer->push_back(held_record);
+    }
+
+    writer.reset();
+    finish_output(output_stream);
+
+    if (bounded)
+        report_memory(options.max_memory);
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <charconv>
 #include <concepts>
 #include <functional>
+#include <limits>
 
 #include <bio/var_io/header.hpp>
 
@@ -19,9 +22,173 @@ concept compatible_alph = (std::same_as<T1, char> && std::same_as<T2, char>) ||
                            std::integral<T2>) ||
                           (std::same_as<T1, float> && std::same_as<T1, float>);
 
+// widen an integer to int32_t, retaining missing values
+inline constexpr auto widen_int = []<std::integral int_t>(int_t const value) -> int32_t
+{
+    return value == bio::var_io::missing_value<int_t> ? bio::var_io::missing_value<int32_t> : value;
+};
+
+// the lowest values of the BCF integer types are reserved (missing, end-of-vector, ...)
+template <typename int_t>
+inline constexpr int64_t min_regular_value = int64_t{std::numeric_limits<int_t>::min()} + 8;
+
+// convert to int_t; throws if the value is not a regular value of int_t instead of wrapping around
+template <typename int_t>
+int_t checked_int(int64_t const value)
+{
+    if (value < min_regular_value<int_t> || value > std::numeric_limits<int_t>::max())
+        throw delta_error{"The difference between two values (", value, ") is too large to be stored."};
+
+    return static_cast<int_t>(value);
+}
+
+/* Store int8_t and int16_t values (or ranges of them) as int32_t, retaining missing values.
+ * Residuals are computed in int32_t by the encoder and the decoder, so that they do not depend on the width that the
+ * values happened to be read with; the writer picks the smallest suitable width again.
+ */
+template <typename variant_t>
+void widen_to_int32(variant_t & value)
+{
+    auto fun = [&]<typename value_t>(value_t & narrow)
+    {
+        if constexpr (std::same_as<value_t, int8_t> || std::same_as<value_t, int16_t>)
+        {
+            value = widen_int(narrow);
+        }
+        else if constexpr (std::same_as<value_t, std::vector<int8_t>> || std::same_as<value_t, std::vector<int16_t>>)
+        {
+            std::vector<int32_t> widened(narrow.size());
+            std::ranges::transform(narrow, widened.begin(), widen_int);
+            value = std::move(widened);
+        }
+        else if constexpr (std::same_as<value_t, seqan3::concatenated_sequences<std::vector<int8_t>>> ||
+                           std::same_as<value_t, seqan3::concatenated_sequences<std::vector<int16_t>>>)
+        {
+            seqan3::concatenated_sequences<std::vector<int32_t>> widened;
+            widened.reserve(narrow.size());
+            widened.concat_reserve(narrow.concat_size());
+            for (auto && inner : narrow)
+            {
+                widened.push_back();
+                for (auto const elem : inner)
+                    widened.last_push_back(widen_int(elem));
+            }
+            value = std::move(widened);
+        }
+    };
+
+    std::visit(fun, value);
+}
+
 // function alias
 auto & formulaG = bio::detail::vcf_gt_formula;
 
+// copy a string or a range of strings into a (possibly different) container type
+template <typename out_t, typename in_t>
+void copy_nested(out_t & out, in_t const & in)
+{
+    if constexpr (std::same_as<std::ranges::range_value_t<out_t>, char>)
+    {
+        out.assign(std::ranges::begin(in), std::ranges::end(in));
+    }
+    else
+    {
+        out.clear();
+        for (auto && elem : in)
+        {
+            std::ranges::range_value_t<out_t> tmp;
+            copy_nested(tmp, elem);
+            out.push_back(std::move(tmp));
+        }
+    }
+}
+
+// one allele of a GT value
+struct gt_allele_t
+{
+    char    sep    = '\0'; // separator before the allele; '\0' for the first allele
+    int32_t allele = -1;   // -1 if missing
+};
+
+// split a GT value like "0/1", "1|2" or "./." into alleles; returns false if it is not a valid GT value
+bool parse_gt(auto const & str, std::vector<gt_allele_t> & out)
+{
+    out.clear();
+    out.emplace_back();
+    bool empty = true;
+
+    for (char const c : str)
+    {
+        if (c == '/' || c == '|')
+        {
+            if (empty)
+                return false;
+            out.push_back({.sep = c});
+            empty = true;
+        }
+        else if (c == '.' && empty)
+        {
+            empty = false;
+        }
+        else if (c >= '0' && c <= '9' && (empty || out.back().allele > 0)) // no leading zeros
+        {
+            out.back().allele = (empty ? 0 : out.back().allele * 10) + (c - '0');
+            empty             = false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return !empty;
+}
+
+// whether the value is "0", "0/0", "0|0", "0/0/0" ...; optionally only unphased
+bool is_hom_ref_gt(auto const & str, bool const unphased_only)
+{
+    size_t const size = std::ranges::size(str);
+    if (size % 2 == 0)
+        return false;
+
+    for (size_t i = 0; i < size; ++i)
+        if (i % 2 == 0 ? str[i] != '0' : str[i] != '/' && (unphased_only || str[i] != '|'))
+            return false;
+
+    return true;
+}
+
+// the classes of Number that the kernels are specialised for
+enum class number_class_t : uint8_t
+{
+    one,
+    dot,
+    A,
+    R,
+    G,
+    fixed, // any other number; the only class where the number is not known at compile-time
+    size
+};
+
+constexpr number_class_t to_number_class(int32_t const number)
+{
+    switch (number)
+    {
+        case 1:
+            return number_class_t::one;
+        case bio::var_io::header_number::dot:
+            return number_class_t::dot;
+        case bio::var_io::header_number::A:
+            return number_class_t::A;
+        case bio::var_io::header_number::R:
+            return number_class_t::R;
+        case bio::var_io::header_number::G:
+            return number_class_t::G;
+        default:
+            return number_class_t::fixed;
+    }
+}
+
 template <typename op_t = std::minus<>, bool skip_problematic = true>
 struct delta_visitor
 {
@@ -29,7 +196,16 @@ struct delta_visitor
     int32_t const          number{};
     size_t const           n_alts{};
 
-    bio::var_io::header const * const hdr_ptr = nullptr;
+    // only samples in [sample_begin, sample_end) are processed; used for cache-blocking
+    size_t const sample_begin = 0;
+    size_t const sample_end   = std::numeric_limits<size_t>::max();
+
+    // the replaced samples of a STRING field, written when encoding and read when decoding (see transform_strings())
+    std::vector<int32_t> * const same_runs = nullptr;
+
+    // buffers for the alleles of GT values, reused for all samples
+    mutable std::vector<gt_allele_t> cur_alleles{};
+    mutable std::vector<gt_allele_t> last_alleles{};
 
     static constexpr auto op = bio::detail::overloaded{
       // floats are not substracted/added but XORed instead
@@ -38,19 +214,164 @@ struct delta_visitor
           int32_t & cur_i = *(reinterpret_cast<int32_t *>(&cur));
           cur_i ^= *(reinterpret_cast<int32_t const *>(&last));
       },
-      // integers
+      // integers are widened to int32_t before (see widen_to_int32()); characters wrap around on both sides
       []<typename cur_t, typename last_t>(cur_t & cur, last_t const last)
       {
-          if constexpr (std::same_as<op_t, std::minus<>>)
-              cur -=
-                (cur == bio::var_io::missing_value<cur_t> || last == bio::var_io::missing_value<last_t>) ? 0 : last;
+          if (cur == bio::var_io::missing_value<cur_t> || last == bio::var_io::missing_value<last_t>)
+              return;
+
+          if constexpr (std::same_as<cur_t, char>)
+              cur = std::same_as<op_t, std::minus<>> ? cur - last : cur + last;
+          else if constexpr (std::same_as<op_t, std::minus<>>)
+              cur = checked_int<cur_t>(int64_t{cur} - last);
           else
-              cur +=
-                (cur == bio::var_io::missing_value<cur_t> || last == bio::var_io::missing_value<last_t>) ? 0 : last;
+              cur = checked_int<cur_t>(int64_t{cur} + last);
       }};
 
+    // whether replacing the value by the placeholder makes it shorter
+    template <typename str_t>
+    static bool is_replaceable(str_t const & str)
+    {
+        if constexpr (seqan3::range_dimension_v<str_t> == 1) // one string
+            return !std::ranges::empty(str) && !(std::ranges::size(str) == 1 && *std::ranges::begin(str) == '.');
+        else // vector of strings
+            return !std::ranges::empty(str);
+    }
+
+    /* Strings cannot be subtracted. Instead, values that are equal to the reference are replaced in-place by a
+     * placeholder ("." or an empty vector of strings) when encoding, and the replaced samples are recorded in
+     * same_runs: the lengths of alternating runs of kept and replaced samples, starting with kept ones (trailing kept
+     * samples are omitted). When decoding, the replaced samples are restored from the reference. The placeholder
+     * itself carries no information, so it does not matter how other tools rewrite it.
+     */
     template <typename last_rng_t, typename cur_rng_t>
-    void operator()(last_rng_t & last_rng, cur_rng_t & cur_rng) const
+    void transform_strings(last_rng_t const & last_rng, cur_rng_t & cur_rng, size_t const n_sample) const
+    {
+        if (same_runs == nullptr)
+            throw delta_error{"Bug encountered, please report:\n", __FILE__, ": ", __LINE__};
+
+        if constexpr (std::same_as<op_t, std::minus<>>)
+        {
+            same_runs->clear();
+            size_t run_begin = 0;
+            bool   replacing = false; // whether the current run is of replaced samples
+
+            for (size_t i = 0; i < n_sample; ++i)
+            {
+                bool const replace = is_replaceable(cur_rng[i]) && std::ranges::equal(cur_rng[i], last_rng[i]);
+
+                if (replace != replacing)
+                {
+                    same_runs->push_back(checked_int<int32_t>(i - run_begin));
+                    run_begin = i;
+                    replacing = replace;
+                }
+
+                if (replace)
+                {
+                    if constexpr (seqan3::range_dimension_v<cur_rng_t> == 2)
+                        cur_rng[i].assign(1, '.');
+                    else
+                        cur_rng[i].clear();
+                }
+            }
+
+            if (replacing)
+                same_runs->push_back(checked_int<int32_t>(n_sample - run_begin));
+        }
+        else
+        {
+            size_t i = 0;
+            for (size_t k = 0; k < same_runs->size(); ++k)
+            {
+                int32_t const run = (*same_runs)[k];
+                if (run < 0 || i + run > n_sample)
+                    throw delta_error{"The replaced values of field ", id, " do not match the number of samples."};
+
+                if (k % 2 == 1) // replaced
+                    for (size_t j = i; j < i + run; ++j)
+                        copy_nested(cur_rng[j], last_rng[j]);
+
+                i += run;
+            }
+        }
+    }
+
+    /* GT values are delta-compressed per allele: an allele index is swapped with 0 if it is the reference's allele
+     * (and vice versa), and the separator is '/' if the phasing is the same as in the reference and '|' if it
+     * differs. The swap is only done if the reference's allele is a valid allele of the current record, so indices
+     * stay in [0, number of alleles); it is its own inverse. Missing alleles stay missing. So unchanged (diploid)
+     * genotypes become "0/0". Values whose ploidy differs from the reference's and values that are not valid GT
+     * values are stored as-is; the decoder recognises these cases in the same way.
+     */
+    void transform_gt_value(auto const & last, std::string & str) const
+    {
+        constexpr bool encode = std::same_as<op_t, std::minus<>>;
+
+        // fast path for runs of homozygous reference genotypes
+        if constexpr (encode)
+        {
+            if (std::ranges::equal(str, last) && is_hom_ref_gt(str, false))
+            {
+                std::ranges::replace(str, '|', '/');
+                return;
+            }
+        }
+        else
+        {
+            if (str.size() == std::ranges::size(last) && is_hom_ref_gt(str, true) && is_hom_ref_gt(last, false))
+            {
+                str.assign(std::ranges::begin(last), std::ranges::end(last));
+                return;
+            }
+        }
+
+        if (!parse_gt(str, cur_alleles) || !parse_gt(last, last_alleles) || cur_alleles.size() != last_alleles.size())
+            return; // stored as-is
+
+        str.clear();
+        for (size_t k = 0; k < cur_alleles.size(); ++k)
+        {
+            auto const [sep, allele]           = cur_alleles[k];
+            auto const [last_sep, last_allele] = last_alleles[k];
+
+            if (k > 0)
+            {
+                if constexpr (encode)
+                    str.push_back(sep == last_sep ? '/' : '|');
+                else
+                    str.push_back(sep == '/' ? last_sep : last_sep == '/' ? '|' : '/');
+            }
+
+            if (allele < 0)
+            {
+                str.push_back('.');
+            }
+            else
+            {
+                bool const    swap  = last_allele >= 0 && static_cast<size_t>(last_allele) <= n_alts;
+                int32_t const value = !swap ? allele : allele == 0 ? last_allele : allele == last_allele ? 0 : allele;
+
+                char buffer[16];
+                str.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+            }
+        }
+    }
+
+    // the values are changed in-place
+    template <typename last_rng_t, typename cur_rng_t>
+    void transform_gt(last_rng_t const & last_rng, cur_rng_t & cur_rng, size_t const n_sample) const
+    {
+        for (size_t i = 0; i < n_sample; ++i)
+            transform_gt_value(last_rng[i], cur_rng[i]);
+    }
+
+    /* Delta-compress the values of one field. The class of the Number is a template parameter, so that each
+     * (type, Number class) pair gets its own loops; number is only read at run-time for number_class_t::fixed and
+     * for fields with one value per sample. The caller checks that there are not more values than samples.
+     */
+    template <number_class_t number_class, typename last_rng_t, typename cur_rng_t>
+    void apply(last_rng_t const & last_rng, cur_rng_t & cur_rng) const
     {
         using last_alph           = seqan3::range_innermost_value_t<last_rng_t>;
         constexpr size_t last_dim = seqan3::range_dimension_v<last_rng_t>;
@@ -61,180 +382,289 @@ struct delta_visitor
         {
             size_t const n_sample = std::min(last_rng.size(), cur_rng.size());
 
-            if (size_t n_sample_hdr = hdr_ptr->column_labels.size() - 9; n_sample > n_sample_hdr)
-            {
-                throw delta_error{"Current range has more entries (",
-                                  n_sample,
-                                  ") than there are samples in header (",
-                                  n_sample_hdr,
-                                  ")."};
-            }
-
             constexpr auto error_or_not = [](auto &&... args)
             {
                 if constexpr (!skip_problematic)
                     throw delta_error{std::forward<decltype(args)>(args)...};
             };
 
+            size_t const i_begin = sample_begin;
+            size_t const i_end   = std::min(n_sample, sample_end);
+
             if constexpr (cur_dim == 1)
             {
                 if (number != 1)
                     throw delta_error{"wrong dimension"};
 
-                for (size_t j = 0; j < n_sample; ++j)
+                for (size_t j = i_begin; j < i_end; ++j)
                     op(cur_rng[j], last_rng[j]);
             }
+            else if constexpr (cur_dim == 2 && std::same_as<cur_alph, char>) // strings
+            {
+                if (sample_begin != 0) // strings are not tiled
+                    return;
+
+                if (id == "GT")
+                    transform_gt(last_rng, cur_rng, n_sample);
+                else
+                    transform_strings(last_rng, cur_rng, n_sample);
+            }
             else if constexpr (cur_dim == 2)
             {
-                if constexpr (!std::same_as<cur_alph, char>)
+                // If the concats are the same length, directly subtract the concats!
+                // This does not perform checks on the inner lengths, so certain errors may not be detected
+                // NOTE that this is not a problem per se, because the reverse operation will do the same
+                if (std::span cur_concat = cur_rng.concat(), last_concat = last_rng.concat();
+                    cur_concat.size() == last_concat.size() && cur_rng.size() == last_rng.size())
                 {
-                    // If the concats are the same length, directly subtract the concats!
-                    // This does not perform checks on the inner lengths, so certain errors may not be detected
-                    // NOTE that this is not a problem per se, because the reverse operation will do the same
-                    if (std::span cur_concat = cur_rng.concat(), last_concat = last_rng.concat();
-                        cur_concat.size() == last_concat.size() && cur_rng.size() == last_rng.size())
-                    {
-                        for (size_t i = 0; i < cur_concat.size(); ++i)
-                            op(cur_concat[i], last_concat[i]);
+                    // offsets of the sample range in the concatenation
+                    auto concat_pos = [&](size_t const i) -> size_t
+                    { return i >= cur_rng.size() ? cur_concat.size() : cur_rng[i].data() - cur_concat.data(); };
 
-                        return;
-                    }
+                    for (size_t i = concat_pos(i_begin); i < concat_pos(sample_end); ++i)
+                        op(cur_concat[i], last_concat[i]);
+
+                    return;
                 }
 
-                switch (number)
+                if constexpr (number_class == number_class_t::one)
                 {
-                    case 0:
-                        throw delta_error{"Genotype fields cannot be in FLAG state."};
-                        break;
-                    case 1:
-                        throw delta_error{"wrong dimension"};
-                        break;
-                    case bio::var_io::header_number::dot:
-                        if (n_alts == 1) // assuming that number is still same per record
-                        {
-                            for (size_t i = 0; i < n_sample; ++i)
-                            {
-                                if (last_rng[i].size() != cur_rng[i].size())
-                                    continue; // since this is dot, we can't assume anything anyways
-
-                                for (size_t j = 0; j < last_rng[i].size(); ++j)
-                                    op(cur_rng[i][j], last_rng[i][j]);
-                            }
-                        }
-                        else if (id == "PL3") // this is n_alts per one
+                    throw delta_error{"wrong dimension"};
+                }
+                else if constexpr (number_class == number_class_t::dot)
+                {
+                    if (n_alts == 1) // assuming that number is still same per record
+                    {
+                        for (size_t i = i_begin; i < i_end; ++i)
                         {
-                            for (size_t i = 0; i < n_sample; ++i)
-                            {
-                                if (last_rng[i].size() != 1)
-                                    continue;
-
-                                for (size_t j = 0; j < cur_rng[i].size(); ++j)
-                                    op(cur_rng[i][j], last_rng[i][0]);
-                            }
+                            if (last_rng[i].size() != cur_rng[i].size())
+                                continue; // since this is dot, we can't assume anything anyways
+
+                            for (size_t j = 0; j < last_rng[i].size(); ++j)
+                                op(cur_rng[i][j], last_rng[i][j]);
                         }
-                        // else it cannot be compressed
-                        break;
-                    case bio::var_io::header_number::A:
-                        for (size_t i = 0; i < n_sample; ++i)
+                    }
+                    else if (id == "PL3") // this is n_alts per one
+                    {
+                        for (size_t i = i_begin; i < i_end; ++i)
                         {
                             if (last_rng[i].size() != 1)
-                            {
-                                error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", 1, ".");
-                                continue;
-                            }
-                            if (cur_rng[i].size() != n_alts)
-                            {
-                                error_or_not("Current range size: ", cur_rng[i].size(), ". Expected: ", n_alts, ".");
                                 continue;
-                            }
 
-                            for (size_t j = 0; j < n_alts; ++j)
+                            for (size_t j = 0; j < cur_rng[i].size(); ++j)
                                 op(cur_rng[i][j], last_rng[i][0]);
                         }
-                        break;
-                    case bio::var_io::header_number::R:
-                        for (size_t i = 0; i < n_sample; ++i)
+                    }
+                    // else it cannot be compressed
+                }
+                else if constexpr (number_class == number_class_t::A)
+                {
+                    for (size_t i = i_begin; i < i_end; ++i)
+                    {
+                        if (last_rng[i].size() != 1)
                         {
-                            if (last_rng[i].size() != 2)
-                            {
-                                error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", 2, ".");
-                                continue;
-                            }
-                            if (cur_rng[i].size() != n_alts + 1)
-                            {
-                                error_or_not("Current range size: ",
-                                             cur_rng[i].size(),
-                                             ". Expected: ",
-                                             n_alts + 1,
-                                             ".");
-                                continue;
-                            }
-
-                            op(cur_rng[i][0], last_rng[i][0]);
+                            error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", 1, ".");
+                            continue;
+                        }
+                        if (cur_rng[i].size() != n_alts)
+                        {
+                            error_or_not("Current range size: ", cur_rng[i].size(), ". Expected: ", n_alts, ".");
+                            continue;
+                        }
 
-                            for (size_t j = 1; j < n_alts + 1; ++j)
-                                op(cur_rng[i][j], last_rng[i][1]);
+                        for (size_t j = 0; j < n_alts; ++j)
+                            op(cur_rng[i][j], last_rng[i][0]);
+                    }
+                }
+                else if constexpr (number_class == number_class_t::R)
+                {
+                    for (size_t i = i_begin; i < i_end; ++i)
+                    {
+                        if (last_rng[i].size() != 2)
+                        {
+                            error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", 2, ".");
+                            continue;
                         }
-                        break;
-                    case bio::var_io::header_number::G:
+                        if (cur_rng[i].size() != n_alts + 1)
                         {
-                            size_t const inner_size = formulaG(n_alts, n_alts) + 1;
-
-                            for (size_t i = 0; i < n_sample; ++i)
-                            {
-                                if (last_rng[i].size() != 3)
-                                {
-                                    error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", 3, ".");
-                                    continue;
-                                }
-                                if (cur_rng[i].size() != inner_size)
-                                {
-                                    error_or_not("Current range size: ",
-                                                 cur_rng[i].size(),
-                                                 ". Expected: ",
-                                                 inner_size,
-                                                 ".");
-                                    continue;
-                                }
-
-                                // [0, 0] mapped to first value
-                                op(cur_rng[i][0], last_rng[i][0]);
-
-                                // [0, k>=1] mapped to second
-                                for (size_t k = 1; k <= n_alts; ++k)
-                                    op(cur_rng[i][formulaG(0, k)], last_rng[i][1]);
-
-                                // [j>=1, k>=1] mapped to third
-                                for (size_t j = 1; j <= n_alts; ++j)
-                                    for (size_t k = j; k <= n_alts; ++k)
-                                        op(cur_rng[i][formulaG(j, k)], last_rng[i][2]);
-                            }
-                            break;
+                            error_or_not("Current range size: ", cur_rng[i].size(), ". Expected: ", n_alts + 1, ".");
+                            continue;
                         }
-                    default: // any number > 1
-                        assert(number > 1);
-                        for (size_t i = 0; i < n_sample; ++i)
+
+                        op(cur_rng[i][0], last_rng[i][0]);
+
+                        for (size_t j = 1; j < n_alts + 1; ++j)
+                            op(cur_rng[i][j], last_rng[i][1]);
+                    }
+                }
+                else if constexpr (number_class == number_class_t::G)
+                {
+                    size_t const inner_size = formulaG(n_alts, n_alts) + 1;
+
+                    for (size_t i = i_begin; i < i_end; ++i)
+                    {
+                        if (last_rng[i].size() != 3)
                         {
-                            if (last_rng[i].size() != number)
-                            {
-                                error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", number, ".");
-                                continue;
-                            }
-                            if (cur_rng[i].size() != number)
-                            {
-                                error_or_not("Current range size: ", cur_rng[i].size(), ". Expected: ", number, ".");
-                                continue;
-                            }
+                            error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", 3, ".");
+                            continue;
+                        }
+                        if (cur_rng[i].size() != inner_size)
+                        {
+                            error_or_not("Current range size: ", cur_rng[i].size(), ". Expected: ", inner_size, ".");
+                            continue;
+                        }
 
-                            for (size_t j = 0; j < last_rng[i].size(); ++j)
-                                op(cur_rng[i][j], last_rng[i][j]);
+                        // [0, 0] mapped to first value
+                        op(cur_rng[i][0], last_rng[i][0]);
+
+                        // [0, k>=1] mapped to second
+                        for (size_t k = 1; k <= n_alts; ++k)
+                            op(cur_rng[i][formulaG(0, k)], last_rng[i][1]);
+
+                        // [j>=1, k>=1] mapped to third
+                        for (size_t j = 1; j <= n_alts; ++j)
+                            for (size_t k = j; k <= n_alts; ++k)
+                                op(cur_rng[i][formulaG(j, k)], last_rng[i][2]);
+                    }
+                }
+                else // number_class_t::fixed, any other number
+                {
+                    if (number == 0)
+                        throw delta_error{"Genotype fields cannot be in FLAG state."};
+
+                    for (size_t i = i_begin; i < i_end; ++i)
+                    {
+                        if (last_rng[i].size() != number)
+                        {
+                            error_or_not("Last range size: ", last_rng[i].size(), ". Expected: ", number, ".");
+                            continue;
                         }
-                        break;
+                        if (cur_rng[i].size() != number)
+                        {
+                            error_or_not("Current range size: ", cur_rng[i].size(), ". Expected: ", number, ".");
+                            continue;
+                        }
+
+                        for (size_t j = 0; j < last_rng[i].size(); ++j)
+                            op(cur_rng[i][j], last_rng[i][j]);
+                    }
                 }
             }
-            else // cur_dim == 3
+            else // cur_dim == 3, vector-of-strings
             {
-                throw delta_error{"Handling of vector-of-strings in Genotype not implemented"};
+                if (sample_begin == 0) // strings are not tiled
+                    transform_strings(last_rng, cur_rng, n_sample);
+            }
+        }
+        else
+        {
+            throw std::runtime_error{std::string{"Incompatible types between records.\nFunction signature: "} +
+                                     std::string{__PRETTY_FUNCTION__}};
+        }
+    }
+};
+
+// one-dimensional range of numbers (as in INFO fields)
+template <typename t>
+concept numeric_range = std::ranges::random_access_range<t> && std::is_arithmetic_v<std::ranges::range_value_t<t>> &&
+                        !std::same_as<std::ranges::range_value_t<t>, char>;
+
+// like delta_visitor, but for INFO fields which hold single values or one-dimensional ranges
+template <typename op_t = std::minus<>, bool skip_problematic = true>
+struct info_delta_visitor
+{
+    std::string_view const id{};
+    int32_t const          number{};
+    size_t const           n_alts{};
+
+    static constexpr auto op = delta_visitor<op_t, skip_problematic>::op;
+
+    template <typename last_t, typename cur_t>
+    void operator()(last_t & last, cur_t & cur) const
+    {
+        constexpr auto error_or_not = [](auto &&... args)
+        {
+            if constexpr (!skip_problematic)
+                throw delta_error{std::forward<decltype(args)>(args)...};
+        };
+
+        if constexpr (std::same_as<last_t, bool> || std::same_as<cur_t, bool>)
+        {
+            throw delta_error{"INFO field ", id, " is a flag and cannot be delta-compressed."};
+        }
+        else if constexpr (std::is_arithmetic_v<last_t> && std::is_arithmetic_v<cur_t> &&
+                           compatible_alph<last_t, cur_t>)
+        {
+            op(cur, last);
+        }
+        else if constexpr (numeric_range<last_t> && numeric_range<cur_t> &&
+                           compatible_alph<std::ranges::range_value_t<last_t>, std::ranges::range_value_t<cur_t>>)
+        {
+            // the last record is always bi-allelic
+            switch (number)
+            {
+                case 0:
+                    throw delta_error{"INFO field ", id, " is a flag and cannot be delta-compressed."};
+                    break;
+                case bio::var_io::header_number::dot:
+                    if (last.size() == cur.size())
+                        for (size_t i = 0; i < cur.size(); ++i)
+                            op(cur[i], last[i]);
+                    // else it cannot be compressed
+                    break;
+                case bio::var_io::header_number::A:
+                    if (last.size() != 1 || cur.size() != n_alts)
+                    {
+                        error_or_not("Size of INFO field ", id, " does not match number of alleles.");
+                        break;
+                    }
+
+                    for (size_t i = 0; i < n_alts; ++i)
+                        op(cur[i], last[0]);
+                    break;
+                case bio::var_io::header_number::R:
+                    if (last.size() != 2 || cur.size() != n_alts + 1)
+                    {
+                        error_or_not("Size of INFO field ", id, " does not match number of alleles.");
+                        break;
+                    }
+
+                    op(cur[0], last[0]);
+
+                    for (size_t i = 1; i < n_alts + 1; ++i)
+                        op(cur[i], last[1]);
+                    break;
+                case bio::var_io::header_number::G:
+                    {
+                        if (last.size() != 3 || cur.size() != formulaG(n_alts, n_alts) + 1)
+                        {
+                            error_or_not("Size of INFO field ", id, " does not match number of genotypes.");
+                            break;
+                        }
+
+                        // [0, 0] mapped to first value
+                        op(cur[0], last[0]);
+
+                        // [0, k>=1] mapped to second
+                        for (size_t k = 1; k <= n_alts; ++k)
+                            op(cur[formulaG(0, k)], last[1]);
+
+                        // [j>=1, k>=1] mapped to third
+                        for (size_t j = 1; j <= n_alts; ++j)
+                            for (size_t k = j; k <= n_alts; ++k)
+                                op(cur[formulaG(j, k)], last[2]);
+                        break;
+                    }
+                default: // any number >= 1
+                    if (last.size() != cur.size())
+                    {
+                        error_or_not("Size of INFO field ", id, " changed between records.");
+                        break;
+                    }
+
+                    for (size_t i = 0; i < cur.size(); ++i)
+                        op(cur[i], last[i]);
+                    break;
             }
         }
         else
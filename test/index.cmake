@@ -0,0 +1,71 @@
+# Index test, run with "cmake -P" by ctest (see CMakeLists.txt in this directory).
+#
+# INPUT is encoded by bcfdelta with --write-index to BCF (CSI) and to VCF.gz (TBI). Copies of the outputs are indexed
+# by "bcftools index". Region queries with either index must return the same records, and the indexes must report the
+# same number of records per sequence.
+#
+# Variables: BCFDELTA, BCFTOOLS, INPUT, WORK_DIR, REGIONS (separated by spaces)
+
+foreach (var BCFDELTA BCFTOOLS INPUT WORK_DIR REGIONS)
+    if (NOT DEFINED ${var})
+        message (FATAL_ERROR "${var} is not set.")
+    endif ()
+endforeach ()
+
+separate_arguments (regions UNIX_COMMAND "${REGIONS}")
+
+# run the command and fail with its error output if it does not succeed
+function (run)
+    execute_process (COMMAND ${ARGN} RESULT_VARIABLE result ERROR_VARIABLE error OUTPUT_QUIET)
+    if (NOT result EQUAL 0)
+        string (REPLACE ";" " " command "${ARGN}")
+        message (FATAL_ERROR "\"${command}\" failed (${result}):\n${error}")
+    endif ()
+endfunction ()
+
+# fail if the files differ
+function (compare expected actual)
+    execute_process (COMMAND ${CMAKE_COMMAND} -E compare_files "${expected}" "${actual}" RESULT_VARIABLE differ)
+    if (differ)
+        message (FATAL_ERROR "${actual} differs from ${expected}.")
+    endif ()
+endfunction ()
+
+file (REMOVE_RECURSE "${WORK_DIR}")
+file (MAKE_DIRECTORY "${WORK_DIR}")
+
+foreach (format "bcf;csi;-c" "vcf.gz;tbi;-t")
+    list (GET format 0 extension)
+    list (GET format 1 index_extension)
+    list (GET format 2 index_option)
+
+    set (output "${WORK_DIR}/encoded.${extension}")
+    set (copy "${WORK_DIR}/copy.${extension}")
+
+    run (${BCFDELTA} encode --write-index 1 "${INPUT}" "${output}")
+
+    if (NOT EXISTS "${output}.${index_extension}")
+        message (FATAL_ERROR "bcfdelta did not write ${output}.${index_extension}.")
+    endif ()
+    if (EXISTS "${output}.${index_extension}.tmp")
+        message (FATAL_ERROR "bcfdelta did not remove ${output}.${index_extension}.tmp.")
+    endif ()
+
+    run (${CMAKE_COMMAND} -E copy "${output}" "${copy}")
+    run (${BCFTOOLS} index ${index_option} "${copy}")
+
+    execute_process (COMMAND ${BCFTOOLS} index -s "${output}" OUTPUT_FILE "${WORK_DIR}/stats.txt" RESULT_VARIABLE r1)
+    execute_process (COMMAND ${BCFTOOLS} index -s "${copy}" OUTPUT_FILE "${WORK_DIR}/copy.stats.txt" RESULT_VARIABLE r2)
+    if (NOT r1 EQUAL 0 OR NOT r2 EQUAL 0)
+        message (FATAL_ERROR "\"bcftools index -s\" failed for ${output} or ${copy}.")
+    endif ()
+    compare ("${WORK_DIR}/copy.stats.txt" "${WORK_DIR}/stats.txt")
+
+    set (n 0)
+    foreach (region ${regions})
+        math (EXPR n "${n} + 1")
+        run (${BCFTOOLS} view -H -r "${region}" -o "${WORK_DIR}/${extension}.${n}.txt" "${output}")
+        run (${BCFTOOLS} view -H -r "${region}" -o "${WORK_DIR}/${extension}.${n}.copy.txt" "${copy}")
+        compare ("${WORK_DIR}/${extension}.${n}.copy.txt" "${WORK_DIR}/${extension}.${n}.txt")
+    endforeach ()
+endforeach ()
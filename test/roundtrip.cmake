@@ -0,0 +1,76 @@
+# Round-trip test, run with "cmake -P" by ctest (see CMakeLists.txt in this directory).
+#
+# INPUT is converted to BCF by bcftools, encoded with ENCODE_ARGS and decoded by bcfdelta. The records printed by
+# "bcftools view -H" must be the same before encoding and after decoding. Decoding does not undo the splitting of
+# fields, so with REFERENCE_ARGS the expected records are those of "bcfdelta encode --delta-compress 0 REFERENCE_ARGS"
+# instead.
+# With REANCHOR_ARGS, the encoded file is passed through "bcfdelta reanchor REANCHOR_ARGS" before decoding. DECODE_ARGS
+# are passed to "bcfdelta decode".
+#
+# Variables: BCFDELTA, BCFTOOLS, INPUT, WORK_DIR, ENCODE_ARGS, REFERENCE_ARGS, REANCHOR_ARGS, DECODE_ARGS (arguments
+# are separated by spaces) and EXPECT (a regex that the encoded file printed by bcftools must match)
+
+foreach (var BCFDELTA BCFTOOLS INPUT WORK_DIR)
+    if (NOT DEFINED ${var})
+        message (FATAL_ERROR "${var} is not set.")
+    endif ()
+endforeach ()
+
+separate_arguments (encode_args UNIX_COMMAND "${ENCODE_ARGS}")
+separate_arguments (reference_args UNIX_COMMAND "${REFERENCE_ARGS}")
+separate_arguments (reanchor_args UNIX_COMMAND "${REANCHOR_ARGS}")
+separate_arguments (decode_args UNIX_COMMAND "${DECODE_ARGS}")
+
+# run the command and fail with its error output if it does not succeed
+function (run)
+    execute_process (COMMAND ${ARGN} RESULT_VARIABLE result ERROR_VARIABLE error OUTPUT_QUIET)
+    if (NOT result EQUAL 0)
+        string (REPLACE ";" " " command "${ARGN}")
+        message (FATAL_ERROR "\"${command}\" failed (${result}):\n${error}")
+    endif ()
+endfunction ()
+
+file (REMOVE_RECURSE "${WORK_DIR}")
+file (MAKE_DIRECTORY "${WORK_DIR}")
+
+run (${BCFTOOLS} view -O b -o "${WORK_DIR}/plain.bcf" "${INPUT}")
+
+if (REFERENCE_ARGS)
+    run (${BCFDELTA} encode --delta-compress 0 ${reference_args} "${WORK_DIR}/plain.bcf" "${WORK_DIR}/expected.bcf")
+else ()
+    run (${CMAKE_COMMAND} -E copy "${WORK_DIR}/plain.bcf" "${WORK_DIR}/expected.bcf")
+endif ()
+
+run (${BCFDELTA} encode ${encode_args} "${WORK_DIR}/plain.bcf" "${WORK_DIR}/encoded.bcf")
+
+# the records must actually be delta-compressed; with EXPECT, the encoded file must match that regex, too
+run (${BCFTOOLS} view -o "${WORK_DIR}/encoded.txt" "${WORK_DIR}/encoded.bcf")
+file (READ "${WORK_DIR}/encoded.txt" encoded)
+foreach (regex "[\t;]DELTA_COMP[\t;]" ${EXPECT})
+    if (NOT encoded MATCHES "${regex}")
+        message (FATAL_ERROR "The encoded file does not match \"${regex}\", see ${WORK_DIR}/encoded.txt.")
+    endif ()
+endforeach ()
+
+set (to_decode "${WORK_DIR}/encoded.bcf")
+if (REANCHOR_ARGS)
+    run (${BCFDELTA} reanchor ${reanchor_args} "${WORK_DIR}/encoded.bcf" "${WORK_DIR}/reanchored.bcf")
+    set (to_decode "${WORK_DIR}/reanchored.bcf")
+endif ()
+
+run (${BCFDELTA} decode ${decode_args} "${to_decode}" "${WORK_DIR}/decoded.bcf")
+
+run (${BCFTOOLS} view -H -o "${WORK_DIR}/expected.txt" "${WORK_DIR}/expected.bcf")
+run (${BCFTOOLS} view -H -o "${WORK_DIR}/decoded.txt" "${WORK_DIR}/decoded.bcf")
+
+execute_process (COMMAND ${CMAKE_COMMAND} -E compare_files "${WORK_DIR}/expected.txt" "${WORK_DIR}/decoded.txt"
+                 RESULT_VARIABLE differ)
+if (differ)
+    message (FATAL_ERROR "The decoded records differ from the expected ones, see ${WORK_DIR}/expected.txt and "
+                         "${WORK_DIR}/decoded.txt.")
+endif ()
+
+file (READ "${WORK_DIR}/expected.txt" expected)
+if (expected STREQUAL "")
+    message (FATAL_ERROR "${INPUT} has no records.")
+endif ()
@@ -0,0 +1,283 @@
+#pragma once
+
+/* Optional tracing of the encode/decode stages; enabled by building with -DBCFDELTA_TRACING=ON.
+ * Scopes are marked with BCFDELTA_TRACE_SCOPE("name"), which expands to nothing in regular builds.
+ * With --trace, every scope is recorded and written as a Chrome trace (chrome://tracing, Perfetto); a summary per
+ * scope name is printed to stderr. With --trace-counters, the CPU cycles and cache misses of every scope are
+ * measured via perf_event (Linux only; may require a lower kernel.perf_event_paranoid).
+ */
+
+#include <filesystem>
+
+#include <seqan3/argument_parser/all.hpp>
+
+#ifdef BCFDELTA_TRACING
+
+#    include <atomic>
+#    include <chrono>
+#    include <fstream>
+#    include <map>
+#    include <memory>
+#    include <mutex>
+#    include <vector>
+
+#    include <linux/perf_event.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+
+#    include "shared.hpp"
+
+struct trace_event_t
+{
+    char const * name;
+    uint64_t     begin_ns;
+    uint64_t     duration_ns;
+    uint64_t     cycles;
+    uint64_t     cache_misses;
+};
+
+class tracer_t
+{
+public:
+    // per thread; owned by the tracer so that events survive the thread
+    struct thread_state_t
+    {
+        uint32_t                   tid = 0;
+        std::vector<trace_event_t> events;
+        int                        cycles_fd = -1;
+        int                        misses_fd = -1;
+
+        ~thread_state_t()
+        {
+            if (cycles_fd >= 0)
+                ::close(cycles_fd);
+            if (misses_fd >= 0)
+                ::close(misses_fd);
+        }
+
+        uint64_t read_counter(int const fd) const
+        {
+            uint64_t value = 0;
+            if (fd >= 0 && ::read(fd, &value, sizeof(value)) != sizeof(value))
+                value = 0;
+            return value;
+        }
+    };
+
+    // the events of a thread are not recorded beyond this to bound the memory usage
+    static constexpr size_t max_events_per_thread = 1ull << 22;
+
+    static tracer_t & instance()
+    {
+        static tracer_t tracer;
+        return tracer;
+    }
+
+    void enable(bool const with_counters)
+    {
+        counters = with_counters;
+        start    = std::chrono::steady_clock::now();
+        enabled.store(true, std::memory_order_release);
+    }
+
+    bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    uint64_t now_ns() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    thread_state_t & local()
+    {
+        thread_local thread_state_t * state = nullptr;
+
+        if (state == nullptr)
+        {
+            std::lock_guard lock{mutex};
+            threads.emplace_back(new thread_state_t{});
+            state      = threads.back().get();
+            state->tid = threads.size() - 1;
+
+            if (counters)
+            {
+                state->cycles_fd = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+                state->misses_fd = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+                if (state->cycles_fd < 0 || state->misses_fd < 0)
+                    std::cerr << "[bcfdelta trace] Could not open perf_event counters; they are reported as 0.\n";
+            }
+        }
+
+        return *state;
+    }
+
+    bool has_counters() const { return counters; }
+
+    // write all events as Chrome trace and print a summary per scope name
+    void finish(std::filesystem::path const & path)
+    {
+        enabled.store(false, std::memory_order_release);
+        std::lock_guard lock{mutex};
+
+        std::ofstream out{path};
+        if (!out)
+            throw delta_error{"Could not open ", path, " for writing the trace."};
+
+        struct summary_t
+        {
+            size_t   count        = 0;
+            uint64_t duration_ns  = 0;
+            uint64_t cycles       = 0;
+            uint64_t cache_misses = 0;
+        };
+        std::map<std::string_view, summary_t> summary;
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (std::unique_ptr<thread_state_t> const & state : threads)
+        {
+            for (trace_event_t const & event : state->events)
+            {
+                out << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                    << state->tid << ",\"ts\":" << event.begin_ns / 1000.0
+                    << ",\"dur\":" << event.duration_ns / 1000.0;
+                if (counters)
+                    out << ",\"args\":{\"cycles\":" << event.cycles << ",\"cache_misses\":" << event.cache_misses
+                        << "}";
+                out << '}';
+                first = false;
+
+                summary_t & s = summary[event.name];
+                ++s.count;
+                s.duration_ns += event.duration_ns;
+                s.cycles += event.cycles;
+                s.cache_misses += event.cache_misses;
+            }
+
+            if (state->events.size() == max_events_per_thread)
+                std::cerr << "[bcfdelta trace] Thread " << state->tid << " exceeded " << max_events_per_thread
+                          << " events; later events were dropped.\n";
+        }
+        out << "\n]}\n";
+
+        std::cerr << "[bcfdelta trace] scope\tcount\ttime(ms)" << (counters ? "\tcycles\tcache_misses" : "") << '\n';
+        for (auto const & [name, s] : summary)
+        {
+            std::cerr << "[bcfdelta trace] " << name << '\t' << s.count << '\t' << s.duration_ns / 1'000'000.0;
+            if (counters)
+                std::cerr << '\t' << s.cycles << '\t' << s.cache_misses;
+            std::cerr << '\n';
+        }
+    }
+
+private:
+    static int open_counter(uint64_t const config)
+    {
+        perf_event_attr attr{};
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    std::atomic<bool>                            enabled{false};
+    bool                                         counters = false;
+    std::chrono::steady_clock::time_point        start;
+    std::mutex                                   mutex;
+    std::vector<std::unique_ptr<thread_state_t>> threads;
+};
+
+// records the time (and counters) between construction and destruction
+class trace_scope_t
+{
+public:
+    explicit trace_scope_t(char const * const name) : name{name}
+    {
+        tracer_t & tracer = tracer_t::instance();
+        if (!tracer.is_enabled())
+            return;
+
+        state = &tracer.local();
+        if (state->events.size() >= tracer_t::max_events_per_thread)
+        {
+            state = nullptr;
+            return;
+        }
+
+        if (tracer.has_counters())
+        {
+            cycles       = state->read_counter(state->cycles_fd);
+            cache_misses = state->read_counter(state->misses_fd);
+        }
+        begin_ns = tracer.now_ns();
+    }
+
+    ~trace_scope_t()
+    {
+        if (state == nullptr)
+            return;
+
+        tracer_t & tracer = tracer_t::instance();
+        uint64_t   end_ns = tracer.now_ns();
+
+        if (tracer.has_counters())
+        {
+            cycles       = state->read_counter(state->cycles_fd) - cycles;
+            cache_misses = state->read_counter(state->misses_fd) - cache_misses;
+        }
+
+        state->events.push_back({name, begin_ns, end_ns - begin_ns, cycles, cache_misses});
+    }
+
+private:
+    char const * const         name;
+    tracer_t::thread_state_t * state        = nullptr;
+    uint64_t                   begin_ns     = 0;
+    uint64_t                   cycles       = 0;
+    uint64_t                   cache_misses = 0;
+};
+
+#    define BCFDELTA_TRACE_CONCAT_IMPL(a, b) a##b
+#    define BCFDELTA_TRACE_CONCAT(a, b)      BCFDELTA_TRACE_CONCAT_IMPL(a, b)
+#    define BCFDELTA_TRACE_SCOPE(name)       trace_scope_t const BCFDELTA_TRACE_CONCAT(trace_scope_, __LINE__){name}
+
+#else
+
+#    define BCFDELTA_TRACE_SCOPE(name) static_cast<void>(0)
+
+#endif
+
+// the options are only available in builds with tracing
+void add_trace_options([[maybe_unused]] seqan3::argument_parser & parser,
+                       [[maybe_unused]] std::filesystem::path &   trace,
+                       [[maybe_unused]] bool &                    trace_counters)
+{
+#ifdef BCFDELTA_TRACING
+    parser.add_subsection("Tracing:");
+
+    parser.add_option(trace, '\0', "trace", "Write a Chrome trace of the processing stages to this file.");
+
+    parser.add_option(trace_counters,
+                      '\0',
+                      "trace-counters",
+                      "Also measure CPU cycles and cache misses per stage (Linux perf_event).");
+#endif
+}
+
+void start_tracing([[maybe_unused]] std::filesystem::path const & trace, [[maybe_unused]] bool const trace_counters)
+{
+#ifdef BCFDELTA_TRACING
+    if (!trace.empty())
+        tracer_t::instance().enable(trace_counters);
+#endif
+}
+
+void finish_tracing([[maybe_unused]] std::filesystem::path const & trace)
+{
+#ifdef BCFDELTA_TRACING
+    if (!trace.empty())
+        tracer_t::instance().finish(trace);
+#endif
+}
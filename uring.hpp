@@ -0,0 +1,409 @@
+#pragma once
+
+/* Asynchronous file I/O via Linux io_uring; available if liburing was found at configure time.
+ * Reading keeps a fixed number of large reads in flight ahead of the consumer (the BGZF inflaters),
+ * writing hands full buffers to the kernel and continues in the next buffer (behind the deflaters).
+ * make_uring_istream()/make_uring_ostream() return nullptr if io_uring is not available, so that the callers can fall
+ * back to the regular streams.
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "shared.hpp"
+
+#ifdef BCFDELTA_HAVE_LIBURING
+
+#    include <algorithm>
+#    include <cstring>
+#    include <utility>
+#    include <vector>
+
+#    include <fcntl.h>
+#    include <liburing.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+
+// thrown if the kernel does not support (or permit) io_uring
+struct uring_unavailable_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// a block of the file and its buffer; the transfer of a block may complete in several parts
+struct uring_block_t
+{
+    std::vector<char> data;
+    uint64_t          offset  = 0; // in the file
+    size_t            size    = 0; // bytes to transfer
+    size_t            done    = 0; // bytes transferred so far
+    bool              pending = false;
+};
+
+class uring_file_t
+{
+public:
+    static constexpr size_t block_size = 1024 * 1024;
+
+    uring_file_t(std::filesystem::path const & path, int const flags, unsigned const depth, bool const write) :
+      blocks(depth), write{write}
+    {
+        if (int const err = io_uring_queue_init(depth, &ring, 0); err < 0)
+            throw uring_unavailable_error{std::strerror(-err)};
+
+        fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0)
+        {
+            io_uring_queue_exit(&ring);
+            throw delta_error{"Could not open ", path, "."};
+        }
+
+        for (uring_block_t & block : blocks)
+            block.data.resize(block_size);
+    }
+
+    uring_file_t(uring_file_t const &)             = delete;
+    uring_file_t & operator=(uring_file_t const &) = delete;
+
+    ~uring_file_t()
+    {
+        // the kernel may still access the buffers
+        try
+        {
+            while (std::ranges::any_of(blocks, &uring_block_t::pending))
+                wait_one(false);
+        }
+        catch (...)
+        {}
+
+        io_uring_queue_exit(&ring);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    // wait for all transfers and close the file; throws if any transfer or closing failed
+    void close()
+    {
+        for (uring_block_t const & block : blocks)
+            wait_for(block);
+
+        if (::close(std::exchange(fd, -1)) != 0)
+            throw delta_error{"Could not close the file: ", std::strerror(errno)};
+    }
+
+    void submit(uring_block_t & block)
+    {
+        io_uring_sqe * sqe = io_uring_get_sqe(&ring); // never full, because there are as many entries as blocks
+
+        char * const   data   = block.data.data() + block.done;
+        size_t const   size   = block.size - block.done;
+        uint64_t const offset = block.offset + block.done;
+
+        if (write)
+            io_uring_prep_write(sqe, fd, data, size, offset);
+        else
+            io_uring_prep_read(sqe, fd, data, size, offset);
+
+        io_uring_sqe_set_data(sqe, &block);
+        block.pending = true;
+
+        if (int const err = io_uring_submit(&ring); err < 0)
+            throw delta_error{"io_uring submission failed: ", std::strerror(-err)};
+    }
+
+    // wait for one completion; partial transfers are resubmitted if resubmit is true
+    void wait_one(bool const resubmit = true)
+    {
+        io_uring_cqe * cqe = nullptr;
+        int            err = 0;
+        while ((err = io_uring_wait_cqe(&ring, &cqe)) == -EINTR)
+            ;
+        if (err < 0)
+            throw delta_error{"io_uring failed: ", std::strerror(-err)};
+
+        uring_block_t & block = *static_cast<uring_block_t *>(io_uring_cqe_get_data(cqe));
+        int const       res   = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        block.pending = false;
+
+        if (res < 0)
+            throw delta_error{write ? "Writing" : "Reading", " via io_uring failed: ", std::strerror(-res)};
+        else if (res == 0 && write)
+            throw delta_error{"Writing via io_uring failed: no progress."};
+        else if (res == 0) // end of file
+            block.size = block.done;
+
+        block.done += res;
+        if (block.done < block.size && resubmit)
+            submit(block);
+    }
+
+    // wait until the block is not pending anymore
+    void wait_for(uring_block_t const & block)
+    {
+        while (block.pending)
+            wait_one();
+    }
+
+    std::vector<uring_block_t> blocks;
+    int                        fd = -1;
+
+private:
+    io_uring   ring{};
+    bool const write;
+};
+
+class uring_istream : public std::istream
+{
+    struct uring_streambuf : public std::streambuf
+    {
+        uring_file_t file;
+        uint64_t     file_size      = 0;
+        uint64_t     next_offset    = 0; // of the next block to read
+        uint64_t     current_offset = 0; // of the get area
+        size_t       current        = 0; // block in the get area
+        bool         started        = false;
+
+        uring_streambuf(std::filesystem::path const & path, unsigned const depth) :
+          file{path, O_RDONLY, depth, false}
+        {
+            struct stat st;
+            if (::fstat(file.fd, &st) != 0)
+                throw delta_error{"Could not stat ", path, "."};
+            file_size = st.st_size;
+
+            for (uring_block_t & block : file.blocks)
+                start(block);
+        }
+
+        // read the next part of the file into the block (if any)
+        void start(uring_block_t & block)
+        {
+            block.offset = next_offset;
+            block.size   = std::min<uint64_t>(uring_file_t::block_size, file_size - next_offset);
+            block.done   = 0;
+            next_offset += block.size;
+
+            if (block.size > 0)
+                file.submit(block);
+        }
+
+        int_type underflow() override
+        {
+            if (gptr() < egptr())
+                return traits_type::to_int_type(*gptr());
+
+            // the blocks are read round-robin; hand the consumed block back for the next read
+            if (started)
+            {
+                start(file.blocks[current]);
+                current = (current + 1) % file.blocks.size();
+            }
+            started = true;
+
+            uring_block_t & block = file.blocks[current];
+            file.wait_for(block);
+
+            if (block.done == 0) // end of file
+                return traits_type::eof();
+
+            current_offset = block.offset;
+            setg(block.data.data(), block.data.data(), block.data.data() + block.done);
+            return traits_type::to_int_type(*gptr());
+        }
+
+        // only seeking inside the current block is supported (this covers tellg()); anything else throws
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (!(which & std::ios_base::in))
+                throw delta_error{"Only the input position can be changed when reading via io_uring."};
+
+            off_type const now    = current_offset + (gptr() - eback());
+            off_type const base   = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? now : file_size;
+            off_type const target = base + off;
+
+            if (target < off_type(current_offset) || target > off_type(current_offset + (egptr() - eback())))
+            {
+                throw delta_error{"Cannot seek to offset ",
+                                  target,
+                                  " when reading via io_uring (only inside of the current block)."};
+            }
+
+            setg(eback(), eback() + (target - current_offset), egptr());
+            return pos_type(target);
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+        {
+            return seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+    };
+
+    uring_streambuf buf;
+
+public:
+    uring_istream(std::filesystem::path const & path, unsigned const depth) : std::istream{nullptr}, buf{path, depth}
+    {
+        rdbuf(&buf);
+        exceptions(std::ios_base::badbit); // I/O errors are reported as exceptions instead of as end-of-file
+    }
+};
+
+class uring_ostream : public std::ostream
+{
+    struct uring_streambuf : public std::streambuf
+    {
+        uring_file_t file;
+        uint64_t     next_offset = 0; // of the next block to write
+        size_t       current     = 0; // block in the put area
+        bool         closed      = false;
+
+        uring_streambuf(std::filesystem::path const & path, unsigned const depth) :
+          file{path, O_WRONLY | O_CREAT | O_TRUNC, depth, true}
+        {
+            setp(file.blocks[0].data.data(), file.blocks[0].data.data() + uring_file_t::block_size);
+        }
+
+        // close() is called on success; this only happens while the stack is unwound because of another error
+        ~uring_streambuf()
+        {
+            if (closed)
+                return;
+
+            try
+            {
+                sync();
+            }
+            catch (...)
+            {}
+        }
+
+        void close()
+        {
+            if (closed)
+                return;
+            closed = true;
+
+            sync();
+            file.close();
+        }
+
+        // write the put area and continue in the next block once its previous write has completed
+        void submit_current()
+        {
+            uring_block_t & block = file.blocks[current];
+            block.offset          = next_offset;
+            block.size            = pptr() - pbase();
+            block.done            = 0;
+
+            if (block.size == 0)
+                return;
+
+            next_offset += block.size;
+            file.submit(block);
+
+            current              = (current + 1) % file.blocks.size();
+            uring_block_t & next = file.blocks[current];
+            file.wait_for(next);
+            setp(next.data.data(), next.data.data() + uring_file_t::block_size);
+        }
+
+        int_type overflow(int_type ch) override
+        {
+            submit_current();
+
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+
+            return traits_type::not_eof(ch);
+        }
+
+        int sync() override
+        {
+            submit_current();
+
+            for (uring_block_t const & block : file.blocks)
+                file.wait_for(block);
+
+            return 0;
+        }
+
+        // only tellp() is supported
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+                throw delta_error{"The output position cannot be changed when writing via io_uring."};
+
+            return pos_type(off_type(next_offset + (pptr() - pbase())));
+        }
+    };
+
+    uring_streambuf buf;
+
+public:
+    uring_ostream(std::filesystem::path const & path, unsigned const depth) : std::ostream{nullptr}, buf{path, depth}
+    {
+        rdbuf(&buf);
+        exceptions(std::ios_base::badbit);
+    }
+
+    // write all data and close the file; throws delta_error if that fails (e.g. the disk is full)
+    void close() { buf.close(); }
+};
+
+#endif
+
+// an istream that reads the file via io_uring with the given number of blocks in flight; nullptr if not available
+std::unique_ptr<std::istream> make_uring_istream([[maybe_unused]] std::filesystem::path const & path,
+                                                 [[maybe_unused]] unsigned const               depth)
+{
+#ifdef BCFDELTA_HAVE_LIBURING
+    try
+    {
+        return std::unique_ptr<std::istream>{new uring_istream{path, depth}};
+    }
+    catch (uring_unavailable_error const &)
+    {}
+#endif
+    return nullptr;
+}
+
+// an ostream that writes the file via io_uring with the given number of blocks in flight; nullptr if not available
+std::unique_ptr<std::ostream> make_uring_ostream([[maybe_unused]] std::filesystem::path const & path,
+                                                 [[maybe_unused]] unsigned const               depth)
+{
+#ifdef BCFDELTA_HAVE_LIBURING
+    try
+    {
+        return std::unique_ptr<std::ostream>{new uring_ostream{path, depth}};
+    }
+    catch (uring_unavailable_error const &)
+    {}
+#endif
+    return nullptr;
+}
+
+// flush and close an output file stream (regular or io_uring); throws delta_error if that fails
+void close_output_stream(std::ostream & stream)
+{
+#ifdef BCFDELTA_HAVE_LIBURING
+    if (uring_ostream * uring = dynamic_cast<uring_ostream *>(&stream); uring != nullptr)
+    {
+        uring->close();
+        return;
+    }
+#endif
+
+    if (std::ofstream * file = dynamic_cast<std::ofstream *>(&stream); file != nullptr)
+        file->close();
+    else
+        stream.flush();
+
+    if (!stream)
+        throw delta_error{"Could not write the output."};
+}
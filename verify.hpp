@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <bio/var_io/reader.hpp>
+
+#include "checksum.hpp"
+#include "decode.hpp"
+#include "shared.hpp"
+#include "trace.hpp"
+
+/* Decodes the encoded records on a separate thread and compares them with the original records.
+ * Records are copied into pairs that are recycled after verification, so that the buffers are reused.
+ */
+class verifier_t
+{
+public:
+    verifier_t(bio::var_io::header const & hdr, size_t const max_queue_size) :
+      decoder{.in_hdr = hdr}, max_queue_size{max_queue_size}, thread{[this] { run(); }}
+    {}
+
+    ~verifier_t()
+    {
+        if (thread.joinable())
+        {
+            {
+                std::lock_guard lock{mutex};
+                done = true;
+            }
+            cv_work.notify_one();
+            thread.join();
+        }
+    }
+
+    // queue the encoded record and the original record for verification; blocks if the queue is full
+    void push(bio::var_io::default_record<> const & encoded, bio::var_io::default_record<> const & original)
+    {
+        std::unique_ptr<record_pair_t> pair;
+
+        {
+            BCFDELTA_TRACE_SCOPE("verify (wait for space)");
+            std::unique_lock lock{mutex};
+            cv_space.wait(lock, [this] { return queue.size() < max_queue_size || !error.empty(); });
+
+            if (!error.empty())
+                throw delta_error{error};
+
+            if (!pool.empty())
+            {
+                pair = std::move(pool.back());
+                pool.pop_back();
+            }
+        }
+
+        if (!pair)
+            pair.reset(new record_pair_t{});
+
+        pair->first  = encoded;
+        pair->second = original;
+
+        {
+            std::lock_guard lock{mutex};
+            queue.push_back(std::move(pair));
+        }
+        cv_work.notify_one();
+    }
+
+    // halve the number of records that may be queued (at least one) and free the recycled pairs
+    void shrink_queue()
+    {
+        std::lock_guard lock{mutex};
+        max_queue_size = std::max<size_t>(max_queue_size / 2, 1);
+        pool.clear();
+    }
+
+    // wait for all queued records to be verified; throws if any record did not decode to the original
+    void finish()
+    {
+        {
+            std::lock_guard lock{mutex};
+            done = true;
+        }
+        cv_work.notify_one();
+        thread.join();
+
+        if (!error.empty())
+            throw delta_error{error};
+    }
+
+private:
+    using record_pair_t = std::pair<bio::var_io::default_record<>, bio::var_io::default_record<>>;
+
+    void run()
+    {
+        std::string decoded_buffer;
+        std::string original_buffer;
+
+        while (true)
+        {
+            std::unique_ptr<record_pair_t> pair;
+
+            {
+                BCFDELTA_TRACE_SCOPE("verify (wait for work)");
+                std::unique_lock lock{mutex};
+                cv_work.wait(lock, [this] { return !queue.empty() || done; });
+
+                if (queue.empty()) // done
+                    return;
+
+                pair = std::move(queue.front());
+                queue.pop_front();
+            }
+            cv_space.notify_one();
+
+            auto & [decoded, original] = *pair;
+
+            BCFDELTA_TRACE_SCOPE("verify");
+
+            bool is_reference = false;
+            try
+            {
+                is_reference = decoder.decode(decoded);
+
+                decoded_buffer.clear();
+                original_buffer.clear();
+                record_normaliser{decoded_buffer}(decoded);
+                record_normaliser{original_buffer}(original);
+
+                if (decoded_buffer != original_buffer)
+                {
+                    throw delta_error{"Verification failed: record at ",
+                                      original.chrom(),
+                                      ":",
+                                      original.pos(),
+                                      " does not decode to the original record."};
+                }
+            }
+            catch (std::exception const & e)
+            {
+                std::lock_guard lock{mutex};
+                error = e.what();
+                cv_space.notify_all();
+                return;
+            }
+
+            if (is_reference)
+                std::swap(decoder.ref_record, decoded);
+
+            {
+                std::lock_guard lock{mutex};
+                pool.push_back(std::move(pair));
+            }
+        }
+    }
+
+    record_decoder_t decoder;
+    size_t           max_queue_size; // guarded by mutex
+
+    std::mutex                                  mutex;
+    std::condition_variable                     cv_work;
+    std::condition_variable                     cv_space;
+    std::deque<std::unique_ptr<record_pair_t>>  queue;
+    std::vector<std::unique_ptr<record_pair_t>> pool;
+    std::string                                 error;
+    bool                                        done = false;
+
+    std::thread thread;
+};